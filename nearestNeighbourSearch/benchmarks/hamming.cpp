@@ -0,0 +1,94 @@
+/*
+ * Micro-benchmark of the Hamming distance functors on binary descriptors:
+ * HammingSimd against HammingLUT, HammingPopcnt and Hamming, on the usual
+ * descriptor sizes (BRIEF/ORB 32 bytes, FREAK/BRISK 64 bytes, LATCH/binary
+ * embeddings 128 and 512 bytes) and a few sizes that are not multiples of 8.
+ *
+ * g++ -O2 -std=c++11 -I.. -I../flann hamming.cpp -o hamming
+ *
+ * The sizes that are not multiples of 8 are still timed for Hamming, which only
+ * counts the whole words: its column is a lower bound there.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "flann/algorithms/dist.h"
+
+using namespace flann;
+
+namespace
+{
+
+const size_t kLengths[] = { 13, 32, 61, 64, 128, 512 };
+const size_t kVectors = 64;
+
+/**
+ * Keeps the results alive so that the timed calls are not optimized out.
+ */
+volatile double sink;
+
+double seconds()
+{
+    return (double)clock()/CLOCKS_PER_SEC;
+}
+
+/**
+ * Times the distance between all the pairs of kVectors vectors of the given length.
+ *
+ * @return nanoseconds per call
+ */
+template <typename Distance>
+double time_calls(const std::vector<unsigned char>& data, size_t length)
+{
+    Distance distance;
+    size_t repeats = 1 + 20000000/(kVectors*kVectors*(length+8));
+    double sum = 0;
+    double start = seconds();
+    for (size_t r=0; r<repeats; ++r) {
+        for (size_t i=0; i<kVectors; ++i) {
+            for (size_t j=0; j<kVectors; ++j) {
+                sum += distance(&data[i*length], &data[j*length], length);
+            }
+        }
+    }
+    double elapsed = seconds()-start;
+    sink = sum;
+    return elapsed*1e9/(repeats*kVectors*kVectors);
+}
+
+/**
+ * HammingLUT takes an int size.
+ */
+struct LUTCall
+{
+    int operator()(const unsigned char* a, const unsigned char* b, size_t size) const
+    {
+        return HammingLUT()(a, b, (int)size);
+    }
+};
+
+}
+
+int main()
+{
+    printf("%5s %10s %10s %10s %10s   (ns per call)\n", "bytes", "LUT", "Popcnt", "Hamming", "Simd");
+    std::vector<unsigned char> data;
+    for (size_t l=0; l<sizeof(kLengths)/sizeof(kLengths[0]); ++l) {
+        size_t length = kLengths[l];
+        // room for Hamming and HammingPopcnt to read whole words past the last vector
+        data.resize(kVectors*length+8);
+        for (size_t i=0; i<data.size(); ++i) {
+            data[i] = (unsigned char)(rand()&0xff);
+        }
+
+        double lut = time_calls<LUTCall>(data, length);
+        double popcnt = time_calls<HammingPopcnt<unsigned char> >(data, length);
+        double hamming = time_calls<Hamming<unsigned char> >(data, length);
+        double simd = time_calls<HammingSimd<unsigned char> >(data, length);
+        printf("%5u %10.2f %10.2f %10.2f %10.2f\n", (unsigned)length, lut, popcnt, hamming, simd);
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Micro-benchmark of the distance kernels: for every kernel family it times the
+ * scalar kernel, the kernel picked for this processor and the distance functor
+ * that dispatches to it, on vectors of a few lengths (some of them not multiples
+ * of any vector width).
+ *
+ * g++ -O1 -std=c++11 -I.. -I../flann simd_kernels.cpp -o simd_kernels
+ *
+ * Build it at several optimization levels, and once with -DFLANN_NO_SIMD to time
+ * the functors without kernels: the functor column should never be slower than
+ * the scalar one.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "flann/algorithms/dist.h"
+
+using namespace flann;
+
+namespace
+{
+
+const size_t kLengths[] = { 3, 17, 128, 1001 };
+const size_t kVectors = 64;
+
+/**
+ * Keeps the results alive so that the timed calls are not optimized out.
+ */
+volatile double sink;
+
+double seconds()
+{
+    return (double)clock()/CLOCKS_PER_SEC;
+}
+
+template <typename T>
+void fill(std::vector<T>& values, size_t count)
+{
+    values.resize(count);
+    for (size_t i=0; i<count; ++i) {
+        values[i] = T(1+rand()%255);
+    }
+}
+
+/**
+ * Times a call of f on all the pairs of kVectors vectors of the given length.
+ *
+ * @return nanoseconds per call
+ */
+template <typename T, typename Function>
+double time_calls(Function f, const std::vector<T>& data, size_t length)
+{
+    size_t repeats = 1 + 20000000/(kVectors*kVectors*(length+8));
+    double sum = 0;
+    double start = seconds();
+    for (size_t r=0; r<repeats; ++r) {
+        for (size_t i=0; i<kVectors; ++i) {
+            for (size_t j=0; j<kVectors; ++j) {
+                sum += f(&data[i*length], &data[j*length], length);
+            }
+        }
+    }
+    double elapsed = seconds()-start;
+    sink = sum;
+    return elapsed*1e9/(repeats*kVectors*kVectors);
+}
+
+/**
+ * Calls a kernel of a family through a function pointer, with no early exit.
+ */
+template <typename Family, typename T>
+struct KernelCall
+{
+    typename Family::Function function;
+
+    explicit KernelCall(typename Family::Function function_) : function(function_) {}
+
+    double operator()(const T* a, const T* b, size_t size) const
+    {
+        return function(a, b, size, -1);
+    }
+};
+
+/**
+ * Calls a distance functor.
+ */
+template <typename Distance>
+struct FunctorCall
+{
+    double operator()(const typename Distance::ElementType* a, const typename Distance::ElementType* b, size_t size) const
+    {
+        return Distance()(a, b, size);
+    }
+};
+
+template <typename Family, typename Distance, typename T>
+void run(const char* name)
+{
+    std::vector<T> data;
+    for (size_t l=0; l<sizeof(kLengths)/sizeof(kLengths[0]); ++l) {
+        size_t length = kLengths[l];
+        fill(data, kVectors*length);
+
+        double functor = time_calls<T>(FunctorCall<Distance>(), data, length);
+#ifdef FLANN_SIMD_X86
+        CpuFeatures none;
+        memset(&none, 0, sizeof(none));
+        double scalar = time_calls<T>(KernelCall<Family, T>(Family::select(none)), data, length);
+        double simd = time_calls<T>(KernelCall<Family, T>(Family::select(detect_cpu_features())), data, length);
+        printf("%-18s %5u %10.2f %10.2f %10.2f\n", name, (unsigned)length, scalar, simd, functor);
+#else
+        printf("%-18s %5u %10s %10s %10.2f\n", name, (unsigned)length, "-", "-", functor);
+#endif
+    }
+}
+
+#ifdef FLANN_SIMD_X86
+typedef simd::L2Float L2Family;
+typedef simd::ElementwiseFloat<simd::AbsDiffOp> L1Family;
+typedef simd::ElementwiseFloat<simd::MaxAbsDiffOp> MaxFamily;
+typedef simd::ElementwiseFloat<simd::MinOp> HistIntersectionFamily;
+typedef simd::ElementwiseFloat<simd::ChiSquareOp> ChiSquareFamily;
+typedef simd::KLFloat KLFamily;
+typedef simd::InnerProductFloat InnerProductFamily;
+typedef simd::CosineFloat CosineFamily;
+typedef simd::L2Byte<false> L2ByteFamily;
+typedef simd::L1Byte<false> L1ByteFamily;
+#else
+typedef void L2Family;
+typedef void L1Family;
+typedef void MaxFamily;
+typedef void HistIntersectionFamily;
+typedef void ChiSquareFamily;
+typedef void KLFamily;
+typedef void InnerProductFamily;
+typedef void CosineFamily;
+typedef void L2ByteFamily;
+typedef void L1ByteFamily;
+#endif
+
+}
+
+int main()
+{
+    printf("%-18s %5s %10s %10s %10s   (ns per call)\n", "kernel", "size", "scalar", "simd", "functor");
+    run<L2Family, L2<float>, float>("L2<float>");
+    run<L1Family, L1<float>, float>("L1<float>");
+    run<MaxFamily, MaxDistance<float>, float>("Max<float>");
+    run<HistIntersectionFamily, HistIntersectionDistance<float>, float>("HistInt<float>");
+    run<ChiSquareFamily, ChiSquareDistance<float>, float>("ChiSquare<float>");
+    run<KLFamily, KL_Divergence<float>, float>("KL<float>");
+    run<InnerProductFamily, InnerProduct<float>, float>("InnerProd<float>");
+    run<CosineFamily, Cosine<float>, float>("Cosine<float>");
+    run<L2ByteFamily, L2<unsigned char>, unsigned char>("L2<uchar>");
+    run<L1ByteFamily, L1<unsigned char>, unsigned char>("L1<uchar>");
+    return 0;
+}
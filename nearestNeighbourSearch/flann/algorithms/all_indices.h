@@ -42,18 +42,6 @@
 namespace flann
 {
 
-    /**
-     * enable_if sfinae helper
-     */
-    template<bool, typename T = void> struct enable_if{};
-    template<typename T> struct enable_if<true, T> { typedef T type; };
-
-    /**
-     * disable_if sfinae helper
-     */
-    template<bool, typename T> struct disable_if{ typedef T type; };
-    template<typename T> struct disable_if<true, T> { };
-
     /**
      * Check if two type are the same
      */
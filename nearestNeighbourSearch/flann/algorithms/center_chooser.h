@@ -9,6 +9,7 @@
 #define CENTER_CHOOSER_H_
 
 #include "../util/matrix.h"
+#include "../util/random.h"
 
 namespace flann
 {
@@ -77,12 +78,26 @@ public:
     typedef typename Distance::ElementType ElementType;
     typedef typename Distance::ResultType DistanceType;
 
-    CenterChooser(const Distance& distance, const std::vector<ElementType*>& points) : distance_(distance), points_(points) {};
+    CenterChooser(const Distance& distance, const std::vector<ElementType*>& points) :
+        distance_(distance), points_(points), sample_per_center_(0) {};
 
     virtual ~CenterChooser() {};
     
     void setDataSize(size_t cols) { cols_ = cols; }
 
+    /**
+     * Seeds the chooser's own random numbers (a chooser is used by one thread at a time).
+     */
+    void seed(unsigned int seed) { random_.seed(seed); }
+
+    /**
+     * Makes the k-means++ and group-wise choosers, which compute potentials
+     * over all the points, choose k centers among a uniform random sample of
+     * k*per_center points when there are more points than that.
+     * 0 (the default) always uses all the points.
+     */
+    void setSampleSize(int per_center) { sample_per_center_ = per_center; }
+
     /**
      * Chooses cluster centers
      *
@@ -95,9 +110,30 @@ public:
 	virtual void operator()(int k, int* indices, int indices_length, int* centers, int& centers_length) = 0;
 
 protected:
+    /**
+     * Replaces indices by a uniform random sample of them, see setSampleSize().
+     * The sample is kept in sample_, so indices stays valid until the next call.
+     */
+    void sample(int k, int*& indices, int& indices_length)
+    {
+        if (sample_per_center_<=0 || indices_length/k<=sample_per_center_) return;
+
+        // partial Fisher-Yates shuffle of a copy of the indices
+        int sample_length = k*sample_per_center_;
+        sample_.assign(indices, indices+indices_length);
+        for (int i=0; i<sample_length; ++i) {
+            std::swap(sample_[i], sample_[i+random_.rand_int(indices_length-i)]);
+        }
+        indices = &sample_[0];
+        indices_length = sample_length;
+    }
+
 	const Distance distance_;
     const std::vector<ElementType*>& points_;
     size_t cols_;
+    RandomStream random_;
+    int sample_per_center_;
+    std::vector<int> sample_;
 };
 
 
@@ -110,13 +146,14 @@ public:
     using CenterChooser<Distance>::points_;
     using CenterChooser<Distance>::distance_;
     using CenterChooser<Distance>::cols_;
+    using CenterChooser<Distance>::random_;
 
     RandomCenterChooser(const Distance& distance, const std::vector<ElementType*>& points) :
     	CenterChooser<Distance>(distance, points) {}
 
     void operator()(int k, int* indices, int indices_length, int* centers, int& centers_length)
     {
-        UniqueRandom r(indices_length);
+        UniqueRandom r(indices_length, random_);
 
         int index;
         for (index=0; index<k; ++index) 
@@ -165,6 +202,7 @@ public:
     using CenterChooser<Distance>::points_;
     using CenterChooser<Distance>::distance_;
     using CenterChooser<Distance>::cols_;
+    using CenterChooser<Distance>::random_;
 
     GonzalesCenterChooser(const Distance& distance, const std::vector<ElementType*>& points) : 
         CenterChooser<Distance>(distance, points) {}
@@ -173,31 +211,37 @@ public:
     {
         int n = indices_length;
 
-        int rnd = rand_int(n);
+        int rnd = random_.rand_int(n);
         assert(rnd >=0 && rnd < n);
 
         centers[0] = indices[rnd];
 
+        // distance of every point to its closest center, updated with each new
+        // center instead of recomputed from all of them
+        std::vector<DistanceType> closest(n);
+        for (int j=0; j<n; ++j) {
+            closest[j] = distance_(points_[centers[0]],points_[indices[j]],cols_);
+        }
+
         int index;
         for (index=1; index<k; ++index) {
 
             int best_index = -1;
             DistanceType best_val = 0;
             for (int j=0; j<n; ++j) {
-            	DistanceType dist = distance_(points_[centers[0]],points_[indices[j]],cols_);
-                for (int i=1; i<index; ++i) {
-                    DistanceType tmp_dist = distance_(points_[centers[i]],points_[indices[j]],cols_);
-                    if (tmp_dist<dist) {
-                        dist = tmp_dist;
-                    }
-                }
-                if (dist>best_val) {
-                    best_val = dist;
+                if (closest[j]>best_val) {
+                    best_val = closest[j];
                     best_index = j;
                 }
             }
             if (best_index!=-1) {
                 centers[index] = indices[best_index];
+                for (int j=0; j<n; ++j) {
+                    DistanceType tmp_dist = distance_(points_[centers[index]],points_[indices[j]],cols_);
+                    if (tmp_dist<closest[j]) {
+                        closest[j] = tmp_dist;
+                    }
+                }
             }
             else {
                 break;
@@ -222,19 +266,23 @@ public:
     using CenterChooser<Distance>::points_;
     using CenterChooser<Distance>::distance_;
     using CenterChooser<Distance>::cols_;
+    using CenterChooser<Distance>::random_;
+    using CenterChooser<Distance>::sample;
 
     KMeansppCenterChooser(const Distance& distance, const std::vector<ElementType*>& points) : 
         CenterChooser<Distance>(distance, points) {}
 
     void operator()(int k, int* indices, int indices_length, int* centers, int& centers_length)
     {
+        sample(k, indices, indices_length);
+
         int n = indices_length;
 
         double currentPot = 0;
         DistanceType* closestDistSq = new DistanceType[n];
 
         // Choose one random center and set the closestDistSq values
-        int index = rand_int(n);
+        int index = random_.rand_int(n);
         assert(index >=0 && index < n);
         centers[0] = indices[index];
 
@@ -260,7 +308,7 @@ public:
 
                 // Choose our center - have to be slightly careful to return a valid answer even accounting
                 // for possible rounding errors
-                double randVal = rand_double(currentPot);
+                double randVal = random_.rand_double(currentPot);
                 for (index = 0; index < n-1; index++) {
                     if (randVal <= closestDistSq[index]) break;
                     else randVal -= closestDistSq[index];
@@ -318,12 +366,16 @@ public:
     using CenterChooser<Distance>::points_;
     using CenterChooser<Distance>::distance_;
     using CenterChooser<Distance>::cols_;
+    using CenterChooser<Distance>::random_;
+    using CenterChooser<Distance>::sample;
 
     GroupWiseCenterChooser(const Distance& distance, const std::vector<ElementType*>& points) :
         CenterChooser<Distance>(distance, points) {}
 
     void operator()(int k, int* indices, int indices_length, int* centers, int& centers_length)
     {
+        sample(k, indices, indices_length);
+
         const float kSpeedUpFactor = 1.3f;
 
         int n = indices_length;
@@ -331,7 +383,7 @@ public:
         DistanceType* closestDistSq = new DistanceType[n];
 
         // Choose one random center and set the closestDistSq values
-        int index = rand_int(n);
+        int index = random_.rand_int(n);
         assert(index >=0 && index < n);
         centers[0] = indices[index];
 
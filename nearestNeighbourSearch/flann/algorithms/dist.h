@@ -31,6 +31,7 @@
 #ifndef FLANN_DIST_H_
 #define FLANN_DIST_H_
 
+#include <cfloat>
 #include <cmath>
 #include <cstdlib>
 #include <string.h>
@@ -42,6 +43,8 @@ typedef unsigned __int64 uint64_t;
 #endif
 
 #include "flann/defines.h"
+#include "flann/util/half.h"
+#include "dist_simd.h"
 
 
 namespace flann
@@ -61,6 +64,10 @@ template<>
 struct Accumulator<short>  { typedef float Type; };
 template<>
 struct Accumulator<int> { typedef float Type; };
+template<>
+struct Accumulator<float16> { typedef float Type; };
+template<>
+struct Accumulator<bfloat16> { typedef float Type; };
 
 
 
@@ -149,6 +156,12 @@ struct L2
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<L2Kernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType diff0, diff1, diff2, diff3;
         Iterator1 last = a + size;
@@ -190,6 +203,39 @@ struct L2
 };
 
 
+/**
+ * Squared Euclidean distance functor for vectors of a dimension N known at
+ * compile time. Its kernels run constant trip counts, which the compiler
+ * unrolls, with no remainder loop when N is a multiple of the vector width.
+ * Vectors of any other size, or element types without such a kernel, are
+ * handled by L2.
+ */
+template<class T, size_t N>
+struct L2Fixed
+{
+    typedef bool is_kdtree_distance;
+
+    typedef T ElementType;
+    typedef typename Accumulator<T>::Type ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
+    {
+        typedef kernel_dispatch<L2FixedKernel<T, N>, T, Iterator1, Iterator2> Fixed;
+        if (Fixed::value && size==N) {
+            return Fixed::apply(a, b, N, worst_dist);
+        }
+        return L2<T>()(a, b, size, worst_dist);
+    }
+
+    template <typename U, typename V>
+    inline ResultType accum_dist(const U& a, const V& b, int) const
+    {
+        return (a-b)*(a-b);
+    }
+};
+
+
 /*
  * Manhattan distance functor, optimized version
  */
@@ -210,6 +256,12 @@ struct L1
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<L1Kernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType diff0, diff1, diff2, diff3;
         Iterator1 last = a + size;
@@ -259,7 +311,12 @@ struct MinkowskiDistance
 
     int order;
 
-    MinkowskiDistance(int order_) : order(order_) {}
+    /**
+     * Kernel of the order, picked at construction (NULL if there is none)
+     */
+    typename MinkowskiKernel<T>::Function kernel;
+
+    MinkowskiDistance(int order_) : order(order_), kernel(MinkowskiKernel<T>::select(order_)) {}
 
     /**
      *  Compute the Minkowsky (L_p) distance between two vectors.
@@ -273,6 +330,20 @@ struct MinkowskiDistance
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the order, when there is one for T
+        typedef kernel_dispatch<MinkowskiKernel<T>, T, Iterator1, Iterator2> Simd;
+        if (Simd::value && kernel != NULL) {
+            return Simd::call(kernel, a, b, size, worst_dist);
+        }
+
+        // the small integer orders with multiplications instead of pow()
+        switch (order) {
+        case 1: return sum_powers<1>(a, b, size, worst_dist);
+        case 2: return sum_powers<2>(a, b, size, worst_dist);
+        case 3: return sum_powers<3>(a, b, size, worst_dist);
+        case 4: return sum_powers<4>(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType diff0, diff1, diff2, diff3;
         Iterator1 last = a + size;
@@ -308,6 +379,37 @@ struct MinkowskiDistance
     {
         return pow(static_cast<ResultType>(std::abs(a-b)),order);
     }
+
+private:
+    template <int Order>
+    static ResultType power(ResultType x)
+    {
+        ResultType x2 = x*x;
+        return Order==1 ? x : Order==2 ? x2 : Order==3 ? x2*x : x2*x2;
+    }
+
+    template <int Order, typename Iterator1, typename Iterator2>
+    static ResultType sum_powers(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist)
+    {
+        ResultType result = ResultType();
+        Iterator1 last = a + size;
+        Iterator1 lastgroup = last - 3;
+
+        while (a < lastgroup) {
+            result += power<Order>((ResultType)std::abs(a[0] - b[0])) + power<Order>((ResultType)std::abs(a[1] - b[1]))
+                      + power<Order>((ResultType)std::abs(a[2] - b[2])) + power<Order>((ResultType)std::abs(a[3] - b[3]));
+            a += 4;
+            b += 4;
+
+            if ((worst_dist>0)&&(result>worst_dist)) {
+                return result;
+            }
+        }
+        while (a < last) {
+            result += power<Order>((ResultType)std::abs(*a++ - *b++));
+        }
+        return result;
+    }
 };
 
 
@@ -328,6 +430,12 @@ struct MaxDistance
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<MaxKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType diff0, diff1, diff2, diff3;
         Iterator1 last = a + size;
@@ -376,7 +484,7 @@ struct HammingLUT
 
     /** this will count the bits in a ^ b
      */
-    ResultType operator()(const unsigned char* a, const unsigned char* b, int size) const
+    ResultType operator()(const unsigned char* a, const unsigned char* b, int size, ResultType /*worst_dist*/ = -1) const
     {
         ResultType result = 0;
         for (int i = 0; i < size; i++) {
@@ -575,6 +683,42 @@ struct Hamming
     }
 };
 
+/**
+ * Hamming distance functor for binary descriptors, counting the bits with the
+ * widest population count the processor has (64 bit popcnt, AVX2 nibble
+ * lookups or AVX-512 VPOPCNTDQ). The size is in elements of T; the vectorized
+ * kernels are used for unsigned char.
+ */
+template<typename T>
+struct HammingSimd
+{
+    typedef T ElementType;
+    typedef unsigned int ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = 0) const
+    {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<HammingKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
+        const unsigned char* pa = reinterpret_cast<const unsigned char*>(a);
+        const unsigned char* pb = reinterpret_cast<const unsigned char*>(b);
+        size *= sizeof(T);
+        ResultType result = 0;
+        for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+            uint64_t word_a = 0, word_b = 0;
+            size_t count = size-i < sizeof(uint64_t) ? size-i : sizeof(uint64_t);
+            memcpy(&word_a, pa+i, count);
+            memcpy(&word_b, pb+i, count);
+            result += Hamming<T>().popcnt64(word_a ^ word_b);
+        }
+        return result;
+    }
+};
+
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -593,6 +737,12 @@ struct HistIntersectionDistance
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<HistIntersectionKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType min0, min1, min2, min3;
         Iterator1 last = a + size;
@@ -641,12 +791,25 @@ struct HellingerDistance
     typedef T ElementType;
     typedef typename Accumulator<T>::Type ResultType;
 
+    HellingerDistance() : transformed(false) {}
+
+    /**
+     * The vectors compared hold the square roots of the histograms (the index
+     * "pretransform" option stores them so), the distance is then the squared
+     * euclidean distance.
+     */
+    bool transformed;
+
     /**
      *  Compute the Hellinger distance
      */
     template <typename Iterator1, typename Iterator2>
-    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType /*worst_dist*/ = -1) const
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        if (transformed) {
+            return L2<T>()(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType diff0, diff1, diff2, diff3;
         Iterator1 last = a + size;
@@ -695,6 +858,12 @@ struct ChiSquareDistance
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<ChiSquareKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         ResultType sum, diff;
         Iterator1 last = a + size;
@@ -744,10 +913,19 @@ struct KL_Divergence
 
     /**
      *  Compute the Kullback–Leibler divergence
+     *
+     *  The terms of the sum can be negative, so a partial sum says nothing
+     *  about the final value and worst_dist cannot be used to stop early.
      */
     template <typename Iterator1, typename Iterator2>
     ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
     {
+        // vectorized kernel for the processor, when there is one for T
+        typedef simd_dispatch<KLKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
         ResultType result = ResultType();
         Iterator1 last = a + size;
 
@@ -760,10 +938,6 @@ struct KL_Divergence
             }
             ++a;
             ++b;
-
-            if ((worst_dist>0)&&(result>worst_dist)) {
-                return result;
-            }
         }
         return result;
     }
@@ -785,6 +959,561 @@ struct KL_Divergence
     }
 };
 
+
+
+/**
+ * Inner product distance functor, 1-a.b, for maximum inner product search.
+ *
+ * It is not a metric (it is even negative for vectors that are not normalized),
+ * so searches cannot prune branches with it.
+ */
+template<class T>
+struct InnerProduct
+{
+    typedef bool is_vector_space_distance;
+
+    typedef T ElementType;
+    typedef typename Accumulator<T>::Type ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
+    {
+        typedef simd_dispatch<InnerProductKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
+        ResultType result = ResultType();
+        Iterator1 last = a + size;
+        Iterator1 lastgroup = last - 3;
+
+        /* Process 4 items with each loop for efficiency. */
+        while (a < lastgroup) {
+            result += (ResultType)a[0] * (ResultType)b[0] + (ResultType)a[1] * (ResultType)b[1] +
+                      (ResultType)a[2] * (ResultType)b[2] + (ResultType)a[3] * (ResultType)b[3];
+            a += 4;
+            b += 4;
+        }
+        while (a < last) {
+            result += (ResultType)(*a++) * (ResultType)(*b++);
+        }
+        return 1 - result;
+    }
+};
+
+
+/**
+ * Cosine distance functor, 1-a.b/(|a||b|).
+ *
+ * When the vectors are known to have unit length (the index "pretransform"
+ * option normalizes them, see distance_pretransform below) the norms are not
+ * computed and it reduces to the inner product distance.
+ */
+template<class T>
+struct Cosine
+{
+    typedef bool is_vector_space_distance;
+
+    typedef T ElementType;
+    typedef typename Accumulator<T>::Type ResultType;
+
+    Cosine() : normalized(false) {}
+
+    /**
+     * The vectors compared have unit length
+     */
+    bool normalized;
+
+    template <typename Iterator1, typename Iterator2>
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist = -1) const
+    {
+        if (normalized) {
+            return InnerProduct<T>()(a, b, size, worst_dist);
+        }
+
+        typedef simd_dispatch<CosineKernel, T, Iterator1, Iterator2> Simd;
+        if (Simd::value) {
+            return Simd::apply(a, b, size, worst_dist);
+        }
+
+        ResultType dot = ResultType();
+        ResultType norm_a = ResultType();
+        ResultType norm_b = ResultType();
+        Iterator1 last = a + size;
+        while (a < last) {
+            ResultType value_a = (ResultType)(*a++);
+            ResultType value_b = (ResultType)(*b++);
+            dot += value_a * value_b;
+            norm_a += value_a * value_a;
+            norm_b += value_b * value_b;
+        }
+        ResultType norms = norm_a * norm_b;
+        return norms > 0 ? 1 - dot / sqrt(norms) : 1;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Maps the values returned by a distance functor to a metric, i.e. a distance
+ * that satisfies the triangle inequality (for example the squared euclidean
+ * distance is mapped to the euclidean distance). Search algorithms use it to
+ * derive lower bounds on distances they have not computed.
+ *
+ * The default is for functors that are not (a monotone transform of) a metric,
+ * for which no bound can be derived.
+ *
+ * is_metric tells if the functor type can be a metric, is_metric_for if a given
+ * functor is one (a parametrized family may only be a metric for some of its
+ * parameters); the search algorithms only use the bounds when the latter holds.
+ */
+template <typename Distance>
+struct metric_distance
+{
+    typedef typename Distance::ResultType ResultType;
+    static const bool is_metric = false;
+
+    static bool is_metric_for(const Distance&) { return false; }
+
+    static ResultType to_metric(const Distance&, ResultType dist) { return dist; }
+};
+
+template <typename Distance>
+struct squared_metric_distance
+{
+    typedef typename Distance::ResultType ResultType;
+    static const bool is_metric = true;
+
+    static bool is_metric_for(const Distance&) { return true; }
+
+    static ResultType to_metric(const Distance&, ResultType dist) { return (ResultType)sqrt((double)dist); }
+};
+
+template <typename Distance>
+struct identity_metric_distance
+{
+    typedef typename Distance::ResultType ResultType;
+    static const bool is_metric = true;
+
+    static bool is_metric_for(const Distance&) { return true; }
+
+    static ResultType to_metric(const Distance&, ResultType dist) { return dist; }
+};
+
+template <typename T>
+struct metric_distance<L2_Simple<T> > : public squared_metric_distance<L2_Simple<T> > {};
+
+template <typename T>
+struct metric_distance<L2_3D<T> > : public squared_metric_distance<L2_3D<T> > {};
+
+template <typename T>
+struct metric_distance<L2<T> > : public squared_metric_distance<L2<T> > {};
+
+template <typename T, size_t N>
+struct metric_distance<L2Fixed<T, N> > : public squared_metric_distance<L2Fixed<T, N> > {};
+
+template <typename T>
+struct metric_distance<HellingerDistance<T> > : public squared_metric_distance<HellingerDistance<T> > {};
+
+template <typename T>
+struct metric_distance<L1<T> > : public identity_metric_distance<L1<T> > {};
+
+template <typename T>
+struct metric_distance<MaxDistance<T> > : public identity_metric_distance<MaxDistance<T> > {};
+
+template <>
+struct metric_distance<HammingLUT> : public identity_metric_distance<HammingLUT> {};
+
+template <typename T>
+struct metric_distance<HammingPopcnt<T> > : public identity_metric_distance<HammingPopcnt<T> > {};
+
+template <typename T>
+struct metric_distance<Hamming<T> > : public identity_metric_distance<Hamming<T> > {};
+
+template <typename T>
+struct metric_distance<HammingSimd<T> > : public identity_metric_distance<HammingSimd<T> > {};
+
+/**
+ * For vectors of unit length 1-cos(a,b) = |a-b|^2/2, and any vector can be
+ * normalized without changing its cosine distances.
+ */
+template <typename T>
+struct metric_distance<Cosine<T> >
+{
+    typedef typename Cosine<T>::ResultType ResultType;
+    static const bool is_metric = true;
+
+    static bool is_metric_for(const Cosine<T>&) { return true; }
+
+    static ResultType to_metric(const Cosine<T>&, ResultType dist)
+    {
+        return dist>0 ? (ResultType)sqrt(2*(double)dist) : 0;
+    }
+};
+
+/**
+ * The L_p distance only satisfies the triangle inequality for p>=1, smaller
+ * orders get no bounds.
+ */
+template <typename T>
+struct metric_distance<MinkowskiDistance<T> >
+{
+    typedef typename MinkowskiDistance<T>::ResultType ResultType;
+    static const bool is_metric = true;
+
+    static bool is_metric_for(const MinkowskiDistance<T>& distance) { return distance.order>=1; }
+
+    static ResultType to_metric(const MinkowskiDistance<T>& distance, ResultType dist)
+    {
+        return (ResultType)pow((double)dist, 1.0/distance.order);
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Transform applied once to the points stored in an index and to each query, so
+ * that the distance is cheaper to compute on the transformed vectors (the index
+ * "pretransform" option). The default is for functors that have none.
+ */
+template <typename Distance>
+struct distance_pretransform
+{
+    typedef typename Distance::ElementType ElementType;
+    static const bool available = false;
+
+    /**
+     * Transforms a vector (a point or a query) in place
+     */
+    template <typename T>
+    static void apply(const Distance&, T*, size_t) {}
+
+    /**
+     * @return functor computing the same distances on transformed vectors
+     */
+    static Distance transformed(const Distance& distance)
+    {
+        return distance;
+    }
+};
+
+/**
+ * Normalizes the vectors for the cosine distance (floating point types only).
+ */
+template <typename T>
+struct normalizing_pretransform
+{
+    typedef T ElementType;
+    static const bool available = true;
+
+    static void apply(const Cosine<T>&, T* vec, size_t size)
+    {
+        T norm = 0;
+        for (size_t i=0; i<size; ++i) {
+            norm += vec[i]*vec[i];
+        }
+        if (norm>0) {
+            T scale = 1/sqrt(norm);
+            for (size_t i=0; i<size; ++i) {
+                vec[i] *= scale;
+            }
+        }
+    }
+
+    static Cosine<T> transformed(const Cosine<T>& distance)
+    {
+        Cosine<T> result(distance);
+        result.normalized = true;
+        return result;
+    }
+};
+
+template <>
+struct distance_pretransform<Cosine<float> > : public normalizing_pretransform<float> {};
+
+template <>
+struct distance_pretransform<Cosine<double> > : public normalizing_pretransform<double> {};
+
+/**
+ * Takes the square roots of the histograms for the Hellinger distance
+ * (floating point types only).
+ */
+template <typename T>
+struct sqrt_pretransform
+{
+    typedef T ElementType;
+    static const bool available = true;
+
+    static void apply(const HellingerDistance<T>&, T* vec, size_t size)
+    {
+        for (size_t i=0; i<size; ++i) {
+            vec[i] = sqrt(vec[i]);
+        }
+    }
+
+    static HellingerDistance<T> transformed(const HellingerDistance<T>& distance)
+    {
+        HellingerDistance<T> result(distance);
+        result.transformed = true;
+        return result;
+    }
+};
+
+template <>
+struct distance_pretransform<HellingerDistance<float> > : public sqrt_pretransform<float> {};
+
+template <>
+struct distance_pretransform<HellingerDistance<double> > : public sqrt_pretransform<double> {};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Computes the distances between a vector and a block of vectors stored
+ * contiguously, one after the other.
+ *
+ * @param distance distance functor
+ * @param vec the vector to compare against the block
+ * @param block the first vector in the block
+ * @param count number of vectors in the block
+ * @param veclen length of a vector (and stride between consecutive vectors in the block)
+ * @param dists output, distance to every vector in the block
+ */
+template <typename Distance, typename Query>
+inline void distance_block(const Distance& distance, const Query* vec,
+                           const typename Distance::ElementType* block, size_t count, size_t veclen,
+                           typename Distance::ResultType* dists)
+{
+    for (size_t i = 0; i < count; ++i, block += veclen) {
+        dists[i] = distance(vec, block, veclen);
+    }
+}
+
+
+/**
+ * Distances from several vectors to a set of vectors computed together from a
+ * block of dot products (a matrix multiplication), see dot_block(), instead of
+ * one call per pair. The results may differ from the distances by a term that
+ * only depends on the first vector: they rank the vectors of the set the same
+ * way, which is enough to find the closest one. None by default.
+ */
+template <typename Distance>
+struct dot_expansion
+{
+    typedef typename Distance::ElementType ElementType;
+    typedef typename Distance::ResultType ResultType;
+    static const bool available = false;
+    /**
+     * True when subtracting the same vector from both vectors leaves the
+     * distance unchanged: the vectors can then be moved next to the origin
+     * with shift(), where the expansion loses less precision.
+     */
+    static const bool translation_invariant = false;
+
+    static void prepare(const ElementType* const*, size_t, size_t, ElementType*, ResultType*)
+    {
+    }
+
+    static void apply(const ElementType* const*, size_t, const ElementType*, const ResultType*, size_t, size_t,
+                      ResultType*)
+    {
+    }
+
+    static ResultType shift(const ElementType*, const ElementType*, size_t, ElementType*)
+    {
+        return 0;
+    }
+
+    static ResultType error_bound(ResultType, ResultType, size_t)
+    {
+        return 0;
+    }
+};
+
+/**
+ * Stores vectors by coordinate for dot_block(), block[k*dot_block_stride(count)+j]
+ * being coordinate k of vector j.
+ */
+inline void store_dot_block(const float* const* vecs, size_t count, size_t dim, float* block)
+{
+    size_t stride = dot_block_stride(count);
+    for (size_t k=0; k<dim; ++k) {
+        float* coords = block+k*stride;
+        for (size_t j=0; j<count; ++j) coords[j] = vecs[j][k];
+        for (size_t j=count; j<stride; ++j) coords[j] = 0;
+    }
+}
+
+/**
+ * |a-b|^2 - |a|^2 = |b|^2 - 2 a.b
+ */
+struct l2_dot_expansion
+{
+    static const bool available = true;
+
+    /**
+     * Stores the set of vectors the distances are computed to.
+     *
+     * @param b the set of vectors
+     * @param nb number of vectors in b
+     * @param dim length of the vectors
+     * @param block output, dim*dot_block_stride(nb) values
+     * @param norms output, nb values
+     */
+    static void prepare(const float* const* b, size_t nb, size_t dim, float* block, float* norms)
+    {
+        store_dot_block(b, nb, dim, block);
+        for (size_t j=0; j<nb; ++j) {
+            float norm = 0;
+            for (size_t k=0; k<dim; ++k) norm += b[j][k]*b[j][k];
+            norms[j] = norm;
+        }
+    }
+
+    /**
+     * Computes the distances from the vectors of a to a set of vectors.
+     *
+     * @param a the vectors
+     * @param na number of vectors in a
+     * @param block, norms the set of vectors, see prepare()
+     * @param nb number of vectors in the set
+     * @param dim length of the vectors
+     * @param dists output, dists[i*dot_block_stride(nb)+j] is the distance from
+     *              a[i] to vector j of the set, minus |a[i]|^2
+     */
+    static void apply(const float* const* a, size_t na, const float* block, const float* norms, size_t nb, size_t dim,
+                      float* dists)
+    {
+        size_t stride = dot_block_stride(nb);
+        dot_block(a, na, block, stride, dim, dists);
+        for (size_t i=0; i<na; ++i) {
+            float* row = dists+i*stride;
+            for (size_t j=0; j<nb; ++j) row[j] = norms[j]-2*row[j];
+        }
+    }
+
+    static const bool translation_invariant = true;
+
+    /**
+     * Stores vec-origin in out.
+     *
+     * @return the squared norm of vec-origin
+     */
+    static float shift(const float* vec, const float* origin, size_t dim, float* out)
+    {
+        float norm = 0;
+        for (size_t k=0; k<dim; ++k) {
+            out[k] = vec[k]-origin[k];
+            norm += out[k]*out[k];
+        }
+        return norm;
+    }
+
+    /**
+     * Bound on the difference between apply() and the distance minus |a|^2,
+     * both computed in float, for vectors of squared norms at most a_norm and
+     * b_norm. The expansion cancels |a|^2 and |b|^2 out of values of the
+     * order of (|a|+|b|)^2: far from the origin, the rounding error can be
+     * larger than the distances it ranks.
+     */
+    static float error_bound(float a_norm, float b_norm, size_t dim)
+    {
+        float reach = std::sqrt(a_norm)+std::sqrt(b_norm);
+        return (dim+4)*FLT_EPSILON*reach*reach;
+    }
+};
+
+template <>
+struct dot_expansion<L2<float> > : public l2_dot_expansion {};
+
+template <size_t N>
+struct dot_expansion<L2Fixed<float, N> > : public l2_dot_expansion {};
+
+/**
+ * 1 - a.b, the exact distance
+ */
+template <>
+struct dot_expansion<InnerProduct<float> >
+{
+    static const bool available = true;
+
+    static void prepare(const float* const* b, size_t nb, size_t dim, float* block, float*)
+    {
+        store_dot_block(b, nb, dim, block);
+    }
+
+    static void apply(const float* const* a, size_t na, const float* block, const float*, size_t nb, size_t dim,
+                      float* dists)
+    {
+        size_t stride = dot_block_stride(nb);
+        dot_block(a, na, block, stride, dim, dists);
+        for (size_t i=0; i<na; ++i) {
+            float* row = dists+i*stride;
+            for (size_t j=0; j<nb; ++j) row[j] = 1-row[j];
+        }
+    }
+
+    static const bool translation_invariant = false;
+
+    static float shift(const float*, const float*, size_t, float*)
+    {
+        return 0;
+    }
+
+    static float error_bound(float a_norm, float b_norm, size_t dim)
+    {
+        return (dim+2)*FLT_EPSILON*std::sqrt(a_norm*b_norm);
+    }
+};
+
+/**
+ * Distances computed from a vector to a block of vectors stored by coordinate
+ * (structure of arrays: the first coordinate of all the vectors, then the
+ * second one at block+stride, ...), used by the packed leaves of the index.
+ * None by default, the packed leaves then store the vectors one after the other.
+ */
+template <typename Distance>
+struct soa_block_distance
+{
+    typedef typename Distance::ElementType ElementType;
+    typedef typename Distance::ResultType ResultType;
+    static const bool available = false;
+
+    template <typename Query>
+    static void apply(const Distance&, const Query*, const ElementType*, size_t, size_t, ResultType*)
+    {
+    }
+};
+
+/**
+ * Point clouds: several points per instruction instead of one call per point.
+ */
+template <typename T>
+struct soa_block_distance<L2_3D<T> >
+{
+    typedef typename L2_3D<T>::ResultType ResultType;
+    static const bool available = true;
+
+    template <typename Query>
+    static void apply(const L2_3D<T>&, const Query* vec, const T* block, size_t count, size_t stride, ResultType* dists)
+    {
+        typedef block_kernel_dispatch<L2_3DBlockKernel<T> > Simd;
+        if (Simd::value) {
+            Simd::apply(vec, block, count, stride, dists);
+            return;
+        }
+
+        const T* x = block;
+        const T* y = block+stride;
+        const T* z = block+2*stride;
+        for (size_t i = 0; i < count; ++i) {
+            ResultType dx = (ResultType)(x[i] - vec[0]);
+            ResultType dy = (ResultType)(y[i] - vec[1]);
+            ResultType dz = (ResultType)(z[i] - vec[2]);
+            dists[i] = dx*dx + dy*dy + dz*dz;
+        }
+    }
+};
 }
 
 #endif //FLANN_DIST_H_
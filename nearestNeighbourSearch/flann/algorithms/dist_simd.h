@@ -0,0 +1,2728 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2011  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2011  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_DIST_SIMD_H_
+#define FLANN_DIST_SIMD_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <atomic>
+#include <cmath>
+
+#include "flann/util/cpu_features.h"
+#include "flann/util/half.h"
+
+#ifdef FLANN_SIMD_X86
+// the AVX-512 intrinsics of GCC 12 pass self-initialized "undefined" values
+// to the builtins, which it then warns about wherever they are inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/*
+ * Vectorized kernels of the distance functors.
+ *
+ * The kernels for several instruction sets are compiled into every binary (with
+ * gcc and clang each one is tagged with the target it needs, MSVC accepts the
+ * intrinsics anywhere), and the best one supported by the processor is picked
+ * with CPUID the first time a distance is computed. A functor uses a kernel when
+ * there is one for its element type and it is called on plain pointers.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FLANN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FLANN_TARGET(isa)
+#endif
+
+namespace flann
+{
+
+template <typename Iterator, typename T>
+struct is_pointer_to
+{
+    static const bool value = false;
+};
+
+template <typename T>
+struct is_pointer_to<T*, T>
+{
+    static const bool value = true;
+};
+
+template <typename T>
+struct is_pointer_to<const T*, T>
+{
+    static const bool value = true;
+};
+
+/**
+ * Tells if a kernel for arrays of T takes the arguments of a functor: both are
+ * pointers to T, or one of them points to a query of another element type (see
+ * query_element), the kernels for such T having overloads for it.
+ */
+template <typename T, typename Iterator1, typename Iterator2>
+struct is_kernel_operands
+{
+    typedef typename query_element<T>::type Query;
+    static const bool value = (is_pointer_to<Iterator1,T>::value &&
+                               (is_pointer_to<Iterator2,T>::value || is_pointer_to<Iterator2,Query>::value)) ||
+                              (is_pointer_to<Iterator1,Query>::value && is_pointer_to<Iterator2,T>::value);
+};
+
+/**
+ * Selects between a vectorized kernel and the scalar loop of a functor.
+ * Kernel::available tells if the kernel exists; call() runs a kernel the
+ * functor picked at run time.
+ */
+template <typename Kernel, typename T, typename Iterator1, typename Iterator2,
+          bool enabled = Kernel::available && is_kernel_operands<T, Iterator1, Iterator2>::value>
+struct kernel_dispatch
+{
+    static const bool value = false;
+
+    template <typename ResultType>
+    static ResultType apply(Iterator1, Iterator2, size_t, ResultType)
+    {
+        return ResultType();
+    }
+    template <typename Function, typename ResultType>
+    static ResultType call(Function, Iterator1, Iterator2, size_t, ResultType)
+    {
+        return ResultType();
+    }
+};
+
+template <typename Kernel, typename T, typename Iterator1, typename Iterator2>
+struct kernel_dispatch<Kernel, T, Iterator1, Iterator2, true>
+{
+    static const bool value = true;
+
+    template <typename ResultType>
+    static ResultType apply(Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist)
+    {
+        return Kernel::apply(a, b, size, worst_dist);
+    }
+    template <typename Function, typename ResultType>
+    static ResultType call(Function function, Iterator1 a, Iterator2 b, size_t size, ResultType worst_dist)
+    {
+        return function(a, b, size, worst_dist);
+    }
+};
+
+/**
+ * Selects between a vectorized kernel computing the distances from a vector to
+ * a block of vectors and the scalar loop.
+ */
+template <typename Kernel, bool enabled = Kernel::available>
+struct block_kernel_dispatch
+{
+    static const bool value = false;
+
+    template <typename Query, typename T, typename ResultType>
+    static void apply(const Query*, const T*, size_t, size_t, ResultType*)
+    {
+    }
+};
+
+template <typename Kernel>
+struct block_kernel_dispatch<Kernel, true>
+{
+    static const bool value = true;
+
+    template <typename T, typename ResultType>
+    static void apply(const T* vec, const T* block, size_t count, size_t stride, ResultType* dists)
+    {
+        Kernel::apply(vec, block, count, stride, dists);
+    }
+};
+
+/**
+ * Kernel dispatch for the kernel families indexed by the element type:
+ * Kernel<T>::available tells if a kernel exists for arrays of T.
+ */
+template <template <typename> class Kernel, typename T, typename Iterator1, typename Iterator2>
+struct simd_dispatch : public kernel_dispatch<Kernel<T>, T, Iterator1, Iterator2>
+{
+};
+
+/**
+ * Squared euclidean distance kernels, none by default.
+ */
+template <typename T>
+struct L2Kernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Squared euclidean distance kernels for vectors of N elements, none by default.
+ */
+template <typename T, size_t N>
+struct L2FixedKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Kernels computing the squared euclidean distances from a 3-D point to a
+ * block of 3-D points stored by coordinate, none by default.
+ */
+template <typename T>
+struct L2_3DBlockKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Manhattan distance kernels, none by default.
+ */
+template <typename T>
+struct L1Kernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Minkowski distance kernels, none by default. select() gives the kernel of an
+ * order, NULL when there is none.
+ */
+template <typename T>
+struct MinkowskiKernel
+{
+    static const bool available = false;
+
+    typedef void (*Function)();
+
+    static Function select(int)
+    {
+        return NULL;
+    }
+};
+
+/**
+ * Maximum (L_infinity) distance kernels, none by default.
+ */
+template <typename T>
+struct MaxKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Histogram intersection distance kernels, none by default.
+ */
+template <typename T>
+struct HistIntersectionKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Chi-square distance kernels, none by default.
+ */
+template <typename T>
+struct ChiSquareKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Hamming distance kernels, none by default.
+ */
+template <typename T>
+struct HammingKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Kullback-Leibler divergence kernels, none by default.
+ */
+template <typename T>
+struct KLKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Inner product distance kernels, none by default.
+ */
+template <typename T>
+struct InnerProductKernel
+{
+    static const bool available = false;
+};
+
+/**
+ * Cosine distance kernels, none by default.
+ */
+template <typename T>
+struct CosineKernel
+{
+    static const bool available = false;
+};
+
+
+#ifdef FLANN_SIMD_X86
+
+namespace simd
+{
+
+/**
+ * Number of elements between two early-termination tests in the kernels. The
+ * test needs a horizontal sum of the accumulators, doing it after every vector
+ * would cost more than it saves.
+ */
+const size_t kEarlyExitStride = 128;
+
+/**
+ * Clears the upper halves of the ymm/zmm registers when a kernel returns.
+ * The kernels are called from code that may be compiled for SSE only, which
+ * pays a state transition penalty on every legacy SSE instruction while the
+ * upper halves are dirty. gcc inserts vzeroupper only when optimizing at -O2
+ * or above, so every 256 and 512 bit kernel declares one of these first.
+ */
+struct ZeroUpperOnExit
+{
+    FLANN_TARGET("avx")
+    ~ZeroUpperOnExit()
+    {
+        _mm256_zeroupper();
+    }
+};
+
+FLANN_TARGET("sse2")
+inline float hsum_ps(__m128 v)
+{
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+FLANN_TARGET("avx")
+inline float hsum256_ps(__m256 v)
+{
+    return hsum_ps(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+/*
+ * Length policies of the squared euclidean distance kernels. With FixedLength
+ * the trip counts are constants, so the compiler unrolls the loops and drops
+ * the remainder loops when N is a multiple of the vector width.
+ */
+
+struct DynamicLength
+{
+    static size_t get(size_t size)
+    {
+        return size;
+    }
+};
+
+template <size_t N>
+struct FixedLength
+{
+    static size_t get(size_t)
+    {
+        return N;
+    }
+};
+
+/**
+ * Adds the squared differences of the elements [i, size) left over by the
+ * vector loops. Counting the remaining elements down keeps the loop bound
+ * unsigned when size is a constant the loops above have already reached.
+ */
+inline float l2_float_tail(const float* a, const float* b, size_t i, size_t size, float result)
+{
+    for (size_t left = size-i; left>0; --left, ++i) {
+        float diff = a[i]-b[i];
+        result += diff*diff;
+    }
+    return result;
+}
+
+template <typename Length>
+inline float l2_float_scalar(const float* a, const float* b, size_t size, float worst_dist)
+{
+    size = Length::get(size);
+    float result = 0;
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        float diff0 = a[i]-b[i];
+        float diff1 = a[i+1]-b[i+1];
+        float diff2 = a[i+2]-b[i+2];
+        float diff3 = a[i+3]-b[i+3];
+        result += diff0*diff0 + diff1*diff1 + diff2*diff2 + diff3*diff3;
+        if (worst_dist>0 && result>worst_dist) return result;
+    }
+    return l2_float_tail(a, b, i, size, result);
+}
+
+template <typename Length>
+FLANN_TARGET("sse2")
+inline float l2_float_sse2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    size = Length::get(size);
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    while (i+8<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+8<=block_end; i+=8) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = hsum_ps(_mm_add_ps(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    return l2_float_tail(a, b, i, size, hsum_ps(_mm_add_ps(acc0, acc1)));
+}
+
+template <typename Length>
+FLANN_TARGET("avx2,fma")
+inline float l2_float_avx2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    size = Length::get(size);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+32<=block_end; i+=32) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8));
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a+i+16), _mm256_loadu_ps(b+i+16));
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a+i+24), _mm256_loadu_ps(b+i+24));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = hsum256_ps(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    for (; i+8<=size; i+=8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+    return l2_float_tail(a, b, i, size, hsum256_ps(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3))));
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+/*
+ * Halves of a 512 bit register. The extracts zero-masked with a full mask
+ * compile to plain extracts (to nothing for the low half); the casts and the
+ * _mm512_reduce intrinsics go through an undefined pass-through value that
+ * GCC warns about.
+ */
+FLANN_TARGET("avx512f")
+inline __m256 low512_ps(__m512 v)
+{
+    return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(v), 0));
+}
+
+FLANN_TARGET("avx512f")
+inline __m256 high512_ps(__m512 v)
+{
+    return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(v), 1));
+}
+
+FLANN_TARGET("avx512f")
+inline float hsum512_ps(__m512 v)
+{
+    return hsum256_ps(_mm256_add_ps(low512_ps(v), high512_ps(v)));
+}
+
+template <typename Length>
+FLANN_TARGET("avx512f")
+inline float l2_float_avx512(const float* a, const float* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    size = Length::get(size);
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+32<=block_end; i+=32) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a+i), _mm512_loadu_ps(b+i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a+i+16), _mm512_loadu_ps(b+i+16));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = hsum512_ps(_mm512_add_ps(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    if (i<size) {
+        // the last 0-31 elements, with masked loads
+        for (; i<size; i+=16) {
+            size_t left = size-i;
+            __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+            __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a+i), _mm512_maskz_loadu_ps(mask, b+i));
+            acc1 = _mm512_fmadd_ps(d0, d0, acc1);
+        }
+    }
+    return hsum512_ps(_mm512_add_ps(acc0, acc1));
+}
+
+#endif
+
+/*
+ * Inner product (1-a.b) and cosine (1-a.b/(|a||b|)) distance kernels. Neither
+ * distance has a useful early termination, so they always run to the end.
+ */
+
+inline float cosine_from_sums(float dot, float norm_a, float norm_b)
+{
+    float norms = norm_a*norm_b;
+    return norms>0 ? 1-dot/sqrt(norms) : 1;
+}
+
+inline float ip_float_scalar(const float* a, const float* b, size_t size, float)
+{
+    float dot0 = 0, dot1 = 0, dot2 = 0, dot3 = 0;
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        dot0 += a[i]*b[i];
+        dot1 += a[i+1]*b[i+1];
+        dot2 += a[i+2]*b[i+2];
+        dot3 += a[i+3]*b[i+3];
+    }
+    for (; i<size; ++i) {
+        dot0 += a[i]*b[i];
+    }
+    return 1-((dot0+dot1)+(dot2+dot3));
+}
+
+FLANN_TARGET("sse2")
+inline float ip_float_sse2(const float* a, const float* b, size_t size, float)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i+8<=size; i+=8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+    }
+    float dot = hsum_ps(_mm_add_ps(acc0, acc1));
+    for (; i<size; ++i) {
+        dot += a[i]*b[i];
+    }
+    return 1-dot;
+}
+
+FLANN_TARGET("avx2,fma")
+inline float ip_float_avx2(const float* a, const float* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+16), _mm256_loadu_ps(b+i+16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+24), _mm256_loadu_ps(b+i+24), acc3);
+    }
+    for (; i+8<=size; i+=8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+    }
+    float dot = hsum256_ps(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i<size; ++i) {
+        dot += a[i]*b[i];
+    }
+    return 1-dot;
+}
+
+inline float cosine_float_scalar(const float* a, const float* b, size_t size, float)
+{
+    float dot = 0, norm_a = 0, norm_b = 0;
+    for (size_t i=0; i<size; ++i) {
+        dot += a[i]*b[i];
+        norm_a += a[i]*a[i];
+        norm_b += b[i]*b[i];
+    }
+    return cosine_from_sums(dot, norm_a, norm_b);
+}
+
+FLANN_TARGET("sse2")
+inline float cosine_float_sse2(const float* a, const float* b, size_t size, float)
+{
+    __m128 dot = _mm_setzero_ps();
+    __m128 norm_a = _mm_setzero_ps();
+    __m128 norm_b = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        __m128 va = _mm_loadu_ps(a+i);
+        __m128 vb = _mm_loadu_ps(b+i);
+        dot = _mm_add_ps(dot, _mm_mul_ps(va, vb));
+        norm_a = _mm_add_ps(norm_a, _mm_mul_ps(va, va));
+        norm_b = _mm_add_ps(norm_b, _mm_mul_ps(vb, vb));
+    }
+    float sum_dot = hsum_ps(dot), sum_a = hsum_ps(norm_a), sum_b = hsum_ps(norm_b);
+    for (; i<size; ++i) {
+        sum_dot += a[i]*b[i];
+        sum_a += a[i]*a[i];
+        sum_b += b[i]*b[i];
+    }
+    return cosine_from_sums(sum_dot, sum_a, sum_b);
+}
+
+FLANN_TARGET("avx2,fma")
+inline float cosine_float_avx2(const float* a, const float* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m256 dot0 = _mm256_setzero_ps(), dot1 = _mm256_setzero_ps();
+    __m256 norm_a0 = _mm256_setzero_ps(), norm_a1 = _mm256_setzero_ps();
+    __m256 norm_b0 = _mm256_setzero_ps(), norm_b1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i+16<=size; i+=16) {
+        __m256 va0 = _mm256_loadu_ps(a+i), va1 = _mm256_loadu_ps(a+i+8);
+        __m256 vb0 = _mm256_loadu_ps(b+i), vb1 = _mm256_loadu_ps(b+i+8);
+        dot0 = _mm256_fmadd_ps(va0, vb0, dot0);
+        dot1 = _mm256_fmadd_ps(va1, vb1, dot1);
+        norm_a0 = _mm256_fmadd_ps(va0, va0, norm_a0);
+        norm_a1 = _mm256_fmadd_ps(va1, va1, norm_a1);
+        norm_b0 = _mm256_fmadd_ps(vb0, vb0, norm_b0);
+        norm_b1 = _mm256_fmadd_ps(vb1, vb1, norm_b1);
+    }
+    float sum_dot = hsum256_ps(_mm256_add_ps(dot0, dot1));
+    float sum_a = hsum256_ps(_mm256_add_ps(norm_a0, norm_a1));
+    float sum_b = hsum256_ps(_mm256_add_ps(norm_b0, norm_b1));
+    for (; i<size; ++i) {
+        sum_dot += a[i]*b[i];
+        sum_a += a[i]*a[i];
+        sum_b += b[i]*b[i];
+    }
+    return cosine_from_sums(sum_dot, sum_a, sum_b);
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+FLANN_TARGET("avx512f")
+inline float ip_float_avx512(const float* a, const float* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i), _mm512_loadu_ps(b+i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a+i+16), _mm512_loadu_ps(b+i+16), acc1);
+    }
+    for (; i<size; i+=16) {
+        size_t left = size-i;
+        __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a+i), _mm512_maskz_loadu_ps(mask, b+i), acc1);
+    }
+    return 1-hsum512_ps(_mm512_add_ps(acc0, acc1));
+}
+
+FLANN_TARGET("avx512f")
+inline float cosine_float_avx512(const float* a, const float* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m512 dot = _mm512_setzero_ps();
+    __m512 norm_a = _mm512_setzero_ps();
+    __m512 norm_b = _mm512_setzero_ps();
+    for (size_t i=0; i<size; i+=16) {
+        size_t left = size-i;
+        __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+        __m512 va = _mm512_maskz_loadu_ps(mask, a+i);
+        __m512 vb = _mm512_maskz_loadu_ps(mask, b+i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        norm_a = _mm512_fmadd_ps(va, va, norm_a);
+        norm_b = _mm512_fmadd_ps(vb, vb, norm_b);
+    }
+    return cosine_from_sums(hsum512_ps(dot), hsum512_ps(norm_a), hsum512_ps(norm_b));
+}
+
+#endif
+
+/*
+ * Kullback-Leibler divergence kernels: the sum of a*log(a/b) over the elements
+ * where a and b are non zero and a/b positive. The logarithm is the Cephes
+ * single precision one (a degree 8 polynomial on the mantissa reduced to
+ * [sqrt(1/2), sqrt(2)) plus the exponent times log 2), accurate to a couple
+ * of ulps for the normal positive numbers it is given here.
+ */
+
+const float kLogSqrtHalf = 0.707106781186547524f;
+const float kLogP0 = 7.0376836292E-2f;
+const float kLogP1 = -1.1514610310E-1f;
+const float kLogP2 = 1.1676998740E-1f;
+const float kLogP3 = -1.2420140846E-1f;
+const float kLogP4 = 1.4249322787E-1f;
+const float kLogP5 = -1.6668057665E-1f;
+const float kLogP6 = 2.0000714765E-1f;
+const float kLogP7 = -2.4999993993E-1f;
+const float kLogP8 = 3.3333331174E-1f;
+const float kLogQ1 = -2.12194440e-4f;
+const float kLogQ2 = 0.693359375f;
+
+inline float kl_float_scalar(const float* a, const float* b, size_t size, float)
+{
+    float result = 0;
+    for (size_t i=0; i<size; ++i) {
+        if (a[i]!=0 && b[i]!=0) {
+            float ratio = a[i]/b[i];
+            if (ratio>0) {
+                result += a[i]*log(ratio);
+            }
+        }
+    }
+    return result;
+}
+
+FLANN_TARGET("sse2")
+inline __m128 log_ps(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_max_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x00800000)));
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(126)));
+    // mantissa in [0.5, 1), moved to [sqrt(1/2), sqrt(2)) - 1
+    __m128 m = _mm_or_ps(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x807fffff))), _mm_set1_ps(0.5f));
+    __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(kLogSqrtHalf));
+    e = _mm_sub_ps(e, _mm_and_ps(small, one));
+    m = _mm_add_ps(_mm_sub_ps(m, one), _mm_and_ps(small, m));
+    __m128 z = _mm_mul_ps(m, m);
+    __m128 y = _mm_set1_ps(kLogP0);
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP1));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP2));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP3));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP4));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP5));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP6));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP7));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP8));
+    y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(kLogQ1)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    return _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(e, _mm_set1_ps(kLogQ2)));
+}
+
+FLANN_TARGET("sse2")
+inline float kl_float_sse2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    const __m128 zero = _mm_setzero_ps();
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        __m128 va = _mm_loadu_ps(a+i);
+        __m128 vb = _mm_loadu_ps(b+i);
+        __m128 ratio = _mm_div_ps(va, vb);
+        __m128 used = _mm_and_ps(_mm_cmpneq_ps(vb, zero), _mm_cmpgt_ps(ratio, zero));
+        acc = _mm_add_ps(acc, _mm_and_ps(used, _mm_mul_ps(va, log_ps(ratio))));
+    }
+    return hsum_ps(acc) + kl_float_scalar(a+i, b+i, size-i, worst_dist);
+}
+
+FLANN_TARGET("avx2,fma")
+inline __m256 log256_ps(__m256 x)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(126)));
+    __m256 m = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x807fffff))), _mm256_set1_ps(0.5f));
+    __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(kLogSqrtHalf), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, one));
+    m = _mm256_add_ps(_mm256_sub_ps(m, one), _mm256_and_ps(small, m));
+    __m256 z = _mm256_mul_ps(m, m);
+    __m256 y = _mm256_set1_ps(kLogP0);
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP1));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP2));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP3));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP4));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP5));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP6));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP7));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(kLogP8));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(kLogQ1), y);
+    y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+    return _mm256_fmadd_ps(e, _mm256_set1_ps(kLogQ2), _mm256_add_ps(m, y));
+}
+
+FLANN_TARGET("avx2,fma")
+inline float kl_float_avx2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i+8<=size; i+=8) {
+        __m256 va = _mm256_loadu_ps(a+i);
+        __m256 vb = _mm256_loadu_ps(b+i);
+        __m256 ratio = _mm256_div_ps(va, vb);
+        __m256 used = _mm256_and_ps(_mm256_cmp_ps(vb, zero, _CMP_NEQ_OQ), _mm256_cmp_ps(ratio, zero, _CMP_GT_OQ));
+        acc = _mm256_add_ps(acc, _mm256_and_ps(used, _mm256_mul_ps(va, log256_ps(ratio))));
+    }
+    return hsum256_ps(acc) + kl_float_scalar(a+i, b+i, size-i, worst_dist);
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+FLANN_TARGET("avx512f")
+inline __m512 log512_ps(__m512 x)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    x = _mm512_max_ps(x, _mm512_castsi512_ps(_mm512_set1_epi32(0x00800000)));
+    __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(_mm512_castps_si512(x), 23), _mm512_set1_epi32(126)));
+    __m512 m = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x807fffff)),
+                                                   _mm512_castps_si512(_mm512_set1_ps(0.5f))));
+    __mmask16 small = _mm512_cmp_ps_mask(m, _mm512_set1_ps(kLogSqrtHalf), _CMP_LT_OQ);
+    e = _mm512_mask_sub_ps(e, small, e, one);
+    m = _mm512_mask_add_ps(_mm512_sub_ps(m, one), small, _mm512_sub_ps(m, one), m);
+    __m512 z = _mm512_mul_ps(m, m);
+    __m512 y = _mm512_set1_ps(kLogP0);
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP1));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP2));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP3));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP4));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP5));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP6));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP7));
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(kLogP8));
+    y = _mm512_mul_ps(_mm512_mul_ps(y, m), z);
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(kLogQ1), y);
+    y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+    return _mm512_fmadd_ps(e, _mm512_set1_ps(kLogQ2), _mm512_add_ps(m, y));
+}
+
+FLANN_TARGET("avx512f")
+inline float kl_float_avx512(const float* a, const float* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 acc = _mm512_setzero_ps();
+    for (size_t i=0; i<size; i+=16) {
+        size_t left = size-i;
+        __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+        __m512 va = _mm512_maskz_loadu_ps(mask, a+i);
+        __m512 vb = _mm512_maskz_loadu_ps(mask, b+i);
+        __m512 ratio = _mm512_div_ps(va, vb);
+        __mmask16 used = _mm512_cmp_ps_mask(vb, zero, _CMP_NEQ_OQ) & _mm512_cmp_ps_mask(ratio, zero, _CMP_GT_OQ);
+        acc = _mm512_mask_add_ps(acc, used, acc, _mm512_mul_ps(va, log512_ps(ratio)));
+    }
+    return hsum512_ps(acc);
+}
+
+#endif
+
+/*
+ * Kernels of the distances made of one term per element, combined with a sum
+ * or a maximum: Manhattan, maximum, histogram intersection and chi-square. Op
+ * computes the terms and names the Reduction combining them.
+ */
+
+struct SumReduction
+{
+    static float scalar(float acc, float term)
+    {
+        return acc+term;
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 acc, __m128 term)
+    {
+        return _mm_add_ps(acc, term);
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 acc, __m256 term)
+    {
+        return _mm256_add_ps(acc, term);
+    }
+
+    FLANN_TARGET("sse2")
+    static float horizontal(__m128 v)
+    {
+        return hsum_ps(v);
+    }
+
+    FLANN_TARGET("avx2")
+    static float horizontal(__m256 v)
+    {
+        return hsum256_ps(v);
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 acc, __m512 term)
+    {
+        return _mm512_add_ps(acc, term);
+    }
+
+    FLANN_TARGET("avx512f")
+    static float horizontal(__m512 v)
+    {
+        return hsum512_ps(v);
+    }
+#endif
+};
+
+struct MaxReduction
+{
+    static float scalar(float acc, float term)
+    {
+        return term>acc ? term : acc;
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 acc, __m128 term)
+    {
+        return _mm_max_ps(acc, term);
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 acc, __m256 term)
+    {
+        return _mm256_max_ps(acc, term);
+    }
+
+    FLANN_TARGET("sse2")
+    static float horizontal(__m128 v)
+    {
+        v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(v);
+    }
+
+    FLANN_TARGET("avx2")
+    static float horizontal(__m256 v)
+    {
+        return horizontal(_mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 acc, __m512 term)
+    {
+        return _mm512_max_ps(acc, term);
+    }
+
+    FLANN_TARGET("avx512f")
+    static float horizontal(__m512 v)
+    {
+        return horizontal(_mm256_max_ps(low512_ps(v), high512_ps(v)));
+    }
+#endif
+};
+
+/** |a-b| summed, the Manhattan distance */
+struct AbsDiffOp
+{
+    typedef SumReduction Reduction;
+
+    static float scalar(float a, float b)
+    {
+        return fabs(a-b);
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 a, __m128 b)
+    {
+        return _mm_and_ps(_mm_sub_ps(a, b), _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 a, __m256 b)
+    {
+        return _mm256_and_ps(_mm256_sub_ps(a, b), _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 a, __m512 b)
+    {
+        return _mm512_abs_ps(_mm512_sub_ps(a, b));
+    }
+#endif
+};
+
+/** |a-b| maximum, the L_infinity distance */
+struct MaxAbsDiffOp : public AbsDiffOp
+{
+    typedef MaxReduction Reduction;
+};
+
+/** |a-b|^Order summed for Order 3 or 4, the Minkowski distance without the root */
+template <int Order>
+struct PowAbsDiffOp
+{
+    typedef SumReduction Reduction;
+
+    static float scalar(float a, float b)
+    {
+        float diff = fabs(a-b);
+        float diff2 = diff*diff;
+        return diff2*(Order==3 ? diff : diff2);
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 a, __m128 b)
+    {
+        __m128 diff = AbsDiffOp::sse2(a, b);
+        __m128 diff2 = _mm_mul_ps(diff, diff);
+        return _mm_mul_ps(diff2, Order==3 ? diff : diff2);
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 a, __m256 b)
+    {
+        __m256 diff = AbsDiffOp::avx2(a, b);
+        __m256 diff2 = _mm256_mul_ps(diff, diff);
+        return _mm256_mul_ps(diff2, Order==3 ? diff : diff2);
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 a, __m512 b)
+    {
+        __m512 diff = AbsDiffOp::avx512(a, b);
+        __m512 diff2 = _mm512_mul_ps(diff, diff);
+        return _mm512_mul_ps(diff2, Order==3 ? diff : diff2);
+    }
+#endif
+};
+
+/** min(a,b) summed, the histogram intersection */
+struct MinOp
+{
+    typedef SumReduction Reduction;
+
+    static float scalar(float a, float b)
+    {
+        return a<b ? a : b;
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 a, __m128 b)
+    {
+        return _mm_min_ps(a, b);
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 a, __m256 b)
+    {
+        return _mm256_min_ps(a, b);
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 a, __m512 b)
+    {
+        return _mm512_min_ps(a, b);
+    }
+#endif
+};
+
+/** (a-b)^2/(a+b) summed where a+b>0, the chi-square distance */
+struct ChiSquareOp
+{
+    typedef SumReduction Reduction;
+
+    static float scalar(float a, float b)
+    {
+        float sum = a+b;
+        if (sum>0) {
+            float diff = a-b;
+            return diff*diff/sum;
+        }
+        return 0;
+    }
+
+    FLANN_TARGET("sse2")
+    static __m128 sse2(__m128 a, __m128 b)
+    {
+        __m128 sum = _mm_add_ps(a, b);
+        __m128 diff = _mm_sub_ps(a, b);
+        __m128 positive = _mm_cmpgt_ps(sum, _mm_setzero_ps());
+        return _mm_and_ps(positive, _mm_div_ps(_mm_mul_ps(diff, diff), sum));
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 avx2(__m256 a, __m256 b)
+    {
+        __m256 sum = _mm256_add_ps(a, b);
+        __m256 diff = _mm256_sub_ps(a, b);
+        __m256 positive = _mm256_cmp_ps(sum, _mm256_setzero_ps(), _CMP_GT_OQ);
+        return _mm256_and_ps(positive, _mm256_div_ps(_mm256_mul_ps(diff, diff), sum));
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 avx512(__m512 a, __m512 b)
+    {
+        __m512 sum = _mm512_add_ps(a, b);
+        __m512 diff = _mm512_sub_ps(a, b);
+        __mmask16 positive = _mm512_cmp_ps_mask(sum, _mm512_setzero_ps(), _CMP_GT_OQ);
+        return _mm512_maskz_div_ps(positive, _mm512_mul_ps(diff, diff), sum);
+    }
+#endif
+};
+
+template <typename Op>
+inline float elementwise_float_scalar(const float* a, const float* b, size_t size, float worst_dist)
+{
+    typedef typename Op::Reduction Reduction;
+    float result = 0;
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        result = Reduction::scalar(result, Op::scalar(a[i], b[i]));
+        result = Reduction::scalar(result, Op::scalar(a[i+1], b[i+1]));
+        result = Reduction::scalar(result, Op::scalar(a[i+2], b[i+2]));
+        result = Reduction::scalar(result, Op::scalar(a[i+3], b[i+3]));
+        if (worst_dist>0 && result>worst_dist) return result;
+    }
+    for (; i<size; ++i) {
+        result = Reduction::scalar(result, Op::scalar(a[i], b[i]));
+    }
+    return result;
+}
+
+template <typename Op>
+FLANN_TARGET("sse2")
+inline float elementwise_float_sse2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    typedef typename Op::Reduction Reduction;
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    while (i+8<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+8<=block_end; i+=8) {
+            acc0 = Reduction::sse2(acc0, Op::sse2(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+            acc1 = Reduction::sse2(acc1, Op::sse2(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = Reduction::horizontal(Reduction::sse2(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    float result = Reduction::horizontal(Reduction::sse2(acc0, acc1));
+    for (; i<size; ++i) {
+        result = Reduction::scalar(result, Op::scalar(a[i], b[i]));
+    }
+    return result;
+}
+
+template <typename Op>
+FLANN_TARGET("avx2")
+inline float elementwise_float_avx2(const float* a, const float* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    typedef typename Op::Reduction Reduction;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+32<=block_end; i+=32) {
+            acc0 = Reduction::avx2(acc0, Op::avx2(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+            acc1 = Reduction::avx2(acc1, Op::avx2(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8)));
+            acc2 = Reduction::avx2(acc2, Op::avx2(_mm256_loadu_ps(a+i+16), _mm256_loadu_ps(b+i+16)));
+            acc3 = Reduction::avx2(acc3, Op::avx2(_mm256_loadu_ps(a+i+24), _mm256_loadu_ps(b+i+24)));
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = Reduction::horizontal(Reduction::avx2(Reduction::avx2(acc0, acc1), Reduction::avx2(acc2, acc3)));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    for (; i+8<=size; i+=8) {
+        acc0 = Reduction::avx2(acc0, Op::avx2(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+    }
+    float result = Reduction::horizontal(Reduction::avx2(Reduction::avx2(acc0, acc1), Reduction::avx2(acc2, acc3)));
+    for (; i<size; ++i) {
+        result = Reduction::scalar(result, Op::scalar(a[i], b[i]));
+    }
+    return result;
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+template <typename Op>
+FLANN_TARGET("avx512f")
+inline float elementwise_float_avx512(const float* a, const float* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    typedef typename Op::Reduction Reduction;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+32<=block_end; i+=32) {
+            acc0 = Reduction::avx512(acc0, Op::avx512(_mm512_loadu_ps(a+i), _mm512_loadu_ps(b+i)));
+            acc1 = Reduction::avx512(acc1, Op::avx512(_mm512_loadu_ps(a+i+16), _mm512_loadu_ps(b+i+16)));
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = Reduction::horizontal(Reduction::avx512(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    // the last 0-31 elements, with masked loads (the terms of zeros are zero)
+    for (; i<size; i+=16) {
+        size_t left = size-i;
+        __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+        acc1 = Reduction::avx512(acc1, Op::avx512(_mm512_maskz_loadu_ps(mask, a+i), _mm512_maskz_loadu_ps(mask, b+i)));
+    }
+    return Reduction::horizontal(Reduction::avx512(acc0, acc1));
+}
+
+#endif
+
+/*
+ * Squared euclidean distances from a 3-D point to a block of count points
+ * stored by coordinate: the x of all the points, then the y at block+stride
+ * and the z at block+2*stride. One point per lane.
+ */
+
+inline void l2_3d_block_scalar(const float* vec, const float* block, size_t count, size_t stride, float* dists)
+{
+    const float* x = block;
+    const float* y = block+stride;
+    const float* z = block+2*stride;
+    for (size_t i=0; i<count; ++i) {
+        float dx = x[i]-vec[0];
+        float dy = y[i]-vec[1];
+        float dz = z[i]-vec[2];
+        dists[i] = dx*dx + dy*dy + dz*dz;
+    }
+}
+
+FLANN_TARGET("sse2")
+inline void l2_3d_block_sse2(const float* vec, const float* block, size_t count, size_t stride, float* dists)
+{
+    const float* x = block;
+    const float* y = block+stride;
+    const float* z = block+2*stride;
+    const __m128 qx = _mm_set1_ps(vec[0]);
+    const __m128 qy = _mm_set1_ps(vec[1]);
+    const __m128 qz = _mm_set1_ps(vec[2]);
+    size_t i = 0;
+    for (; i+4<=count; i+=4) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x+i), qx);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(y+i), qy);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(z+i), qz);
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        _mm_storeu_ps(dists+i, dist);
+    }
+    l2_3d_block_scalar(vec, block+i, count-i, stride, dists+i);
+}
+
+FLANN_TARGET("avx2,fma")
+inline void l2_3d_block_avx2(const float* vec, const float* block, size_t count, size_t stride, float* dists)
+{
+    ZeroUpperOnExit zero_upper;
+    const float* x = block;
+    const float* y = block+stride;
+    const float* z = block+2*stride;
+    const __m256 qx = _mm256_set1_ps(vec[0]);
+    const __m256 qy = _mm256_set1_ps(vec[1]);
+    const __m256 qz = _mm256_set1_ps(vec[2]);
+    size_t i = 0;
+    for (; i+8<=count; i+=8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x+i), qx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y+i), qy);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z+i), qz);
+        __m256 dist = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        _mm256_storeu_ps(dists+i, dist);
+    }
+    l2_3d_block_scalar(vec, block+i, count-i, stride, dists+i);
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+FLANN_TARGET("avx512f")
+inline void l2_3d_block_avx512(const float* vec, const float* block, size_t count, size_t stride, float* dists)
+{
+    ZeroUpperOnExit zero_upper;
+    const float* x = block;
+    const float* y = block+stride;
+    const float* z = block+2*stride;
+    const __m512 qx = _mm512_set1_ps(vec[0]);
+    const __m512 qy = _mm512_set1_ps(vec[1]);
+    const __m512 qz = _mm512_set1_ps(vec[2]);
+    for (size_t i=0; i<count; i+=16) {
+        size_t left = count-i;
+        __mmask16 mask = left>=16 ? (__mmask16)0xffff : (__mmask16)((1u<<left)-1);
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x+i), qx);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, y+i), qy);
+        __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, z+i), qz);
+        __m512 dist = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        _mm512_mask_storeu_ps(dists+i, mask, dist);
+    }
+}
+
+#endif
+
+/*
+ * Blocks of dot products between a set of vectors a and a set of vectors b
+ * stored by coordinate, b[k*ldb+j] being coordinate k of vector j, with ldb a
+ * multiple of 16 (the vectors past the last one are zeros):
+ * out[i*ldb+j] = a[i].b_j (a small matrix multiplication). A tile of M vectors
+ * of a by N registers of b keeps its sums in registers, so each load feeds
+ * several multiply-adds and no horizontal sum is needed.
+ */
+
+inline void dot_block_scalar(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out)
+{
+    for (size_t i=0; i<na; ++i) {
+        float* row = out+i*ldb;
+        for (size_t j=0; j<ldb; ++j) row[j] = 0;
+        for (size_t k=0; k<dim; ++k) {
+            float x = a[i][k];
+            const float* coords = b+k*ldb;
+            for (size_t j=0; j<ldb; ++j) row[j] += x*coords[j];
+        }
+    }
+}
+
+/**
+ * Fills rows with the pointers to rows vectors of a starting at i, repeating
+ * the last vector of a when fewer are left.
+ */
+inline void dot_tile_rows(const float* const* a, size_t na, size_t i, size_t rows, const float** tile)
+{
+    for (size_t m=0; m<rows; ++m) {
+        tile[m] = a[i+m<na ? i+m : na-1];
+    }
+}
+
+/**
+ * 4 vectors of a by 8 of b
+ */
+FLANN_TARGET("sse2")
+inline void dot_tile_sse2(const float* const* a, const float* b, size_t ldb, size_t dim, float* out, size_t rows)
+{
+    __m128 acc00 = _mm_setzero_ps(), acc01 = _mm_setzero_ps();
+    __m128 acc10 = _mm_setzero_ps(), acc11 = _mm_setzero_ps();
+    __m128 acc20 = _mm_setzero_ps(), acc21 = _mm_setzero_ps();
+    __m128 acc30 = _mm_setzero_ps(), acc31 = _mm_setzero_ps();
+    const float* a0 = a[0];
+    const float* a1 = a[1];
+    const float* a2 = a[2];
+    const float* a3 = a[3];
+    for (size_t k=0; k<dim; ++k, b+=ldb) {
+        __m128 b0 = _mm_loadu_ps(b);
+        __m128 b1 = _mm_loadu_ps(b+4);
+        __m128 x = _mm_set1_ps(a0[k]);
+        acc00 = _mm_add_ps(acc00, _mm_mul_ps(x, b0));
+        acc01 = _mm_add_ps(acc01, _mm_mul_ps(x, b1));
+        x = _mm_set1_ps(a1[k]);
+        acc10 = _mm_add_ps(acc10, _mm_mul_ps(x, b0));
+        acc11 = _mm_add_ps(acc11, _mm_mul_ps(x, b1));
+        x = _mm_set1_ps(a2[k]);
+        acc20 = _mm_add_ps(acc20, _mm_mul_ps(x, b0));
+        acc21 = _mm_add_ps(acc21, _mm_mul_ps(x, b1));
+        x = _mm_set1_ps(a3[k]);
+        acc30 = _mm_add_ps(acc30, _mm_mul_ps(x, b0));
+        acc31 = _mm_add_ps(acc31, _mm_mul_ps(x, b1));
+    }
+    _mm_storeu_ps(out, acc00);
+    _mm_storeu_ps(out+4, acc01);
+    if (rows>1) {
+        _mm_storeu_ps(out+ldb, acc10);
+        _mm_storeu_ps(out+ldb+4, acc11);
+    }
+    if (rows>2) {
+        _mm_storeu_ps(out+2*ldb, acc20);
+        _mm_storeu_ps(out+2*ldb+4, acc21);
+    }
+    if (rows>3) {
+        _mm_storeu_ps(out+3*ldb, acc30);
+        _mm_storeu_ps(out+3*ldb+4, acc31);
+    }
+}
+
+FLANN_TARGET("sse2")
+inline void dot_block_sse2(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out)
+{
+    const float* tile[4];
+    for (size_t i=0; i<na; i+=4) {
+        dot_tile_rows(a, na, i, 4, tile);
+        for (size_t j=0; j<ldb; j+=8) {
+            dot_tile_sse2(tile, b+j, ldb, dim, out+i*ldb+j, na-i);
+        }
+    }
+}
+
+/**
+ * 4 vectors of a by 16 of b
+ */
+FLANN_TARGET("avx2,fma")
+inline void dot_tile_avx2(const float* const* a, const float* b, size_t ldb, size_t dim, float* out, size_t rows)
+{
+    __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+    __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+    __m256 acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps();
+    __m256 acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+    const float* a0 = a[0];
+    const float* a1 = a[1];
+    const float* a2 = a[2];
+    const float* a3 = a[3];
+    for (size_t k=0; k<dim; ++k, b+=ldb) {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b+8);
+        __m256 x = _mm256_broadcast_ss(a0+k);
+        acc00 = _mm256_fmadd_ps(x, b0, acc00);
+        acc01 = _mm256_fmadd_ps(x, b1, acc01);
+        x = _mm256_broadcast_ss(a1+k);
+        acc10 = _mm256_fmadd_ps(x, b0, acc10);
+        acc11 = _mm256_fmadd_ps(x, b1, acc11);
+        x = _mm256_broadcast_ss(a2+k);
+        acc20 = _mm256_fmadd_ps(x, b0, acc20);
+        acc21 = _mm256_fmadd_ps(x, b1, acc21);
+        x = _mm256_broadcast_ss(a3+k);
+        acc30 = _mm256_fmadd_ps(x, b0, acc30);
+        acc31 = _mm256_fmadd_ps(x, b1, acc31);
+    }
+    _mm256_storeu_ps(out, acc00);
+    _mm256_storeu_ps(out+8, acc01);
+    if (rows>1) {
+        _mm256_storeu_ps(out+ldb, acc10);
+        _mm256_storeu_ps(out+ldb+8, acc11);
+    }
+    if (rows>2) {
+        _mm256_storeu_ps(out+2*ldb, acc20);
+        _mm256_storeu_ps(out+2*ldb+8, acc21);
+    }
+    if (rows>3) {
+        _mm256_storeu_ps(out+3*ldb, acc30);
+        _mm256_storeu_ps(out+3*ldb+8, acc31);
+    }
+}
+
+FLANN_TARGET("avx2,fma")
+inline void dot_block_avx2(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out)
+{
+    ZeroUpperOnExit zero_upper;
+    const float* tile[4];
+    for (size_t i=0; i<na; i+=4) {
+        dot_tile_rows(a, na, i, 4, tile);
+        for (size_t j=0; j<ldb; j+=16) {
+            dot_tile_avx2(tile, b+j, ldb, dim, out+i*ldb+j, na-i);
+        }
+    }
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+/**
+ * 8 vectors of a by 16 of b
+ */
+FLANN_TARGET("avx512f")
+inline void dot_tile_avx512(const float* const* a, const float* b, size_t ldb, size_t dim, float* out, size_t rows)
+{
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    __m512 acc4 = _mm512_setzero_ps(), acc5 = _mm512_setzero_ps();
+    __m512 acc6 = _mm512_setzero_ps(), acc7 = _mm512_setzero_ps();
+    const float* a0 = a[0];
+    const float* a1 = a[1];
+    const float* a2 = a[2];
+    const float* a3 = a[3];
+    const float* a4 = a[4];
+    const float* a5 = a[5];
+    const float* a6 = a[6];
+    const float* a7 = a[7];
+    for (size_t k=0; k<dim; ++k, b+=ldb) {
+        __m512 vb = _mm512_loadu_ps(b);
+        acc0 = _mm512_fmadd_ps(_mm512_set1_ps(a0[k]), vb, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_set1_ps(a1[k]), vb, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_set1_ps(a2[k]), vb, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_set1_ps(a3[k]), vb, acc3);
+        acc4 = _mm512_fmadd_ps(_mm512_set1_ps(a4[k]), vb, acc4);
+        acc5 = _mm512_fmadd_ps(_mm512_set1_ps(a5[k]), vb, acc5);
+        acc6 = _mm512_fmadd_ps(_mm512_set1_ps(a6[k]), vb, acc6);
+        acc7 = _mm512_fmadd_ps(_mm512_set1_ps(a7[k]), vb, acc7);
+    }
+    __m512 acc[8] = { acc0, acc1, acc2, acc3, acc4, acc5, acc6, acc7 };
+    for (size_t m=0; m<rows && m<8; ++m) {
+        _mm512_storeu_ps(out+m*ldb, acc[m]);
+    }
+}
+
+FLANN_TARGET("avx512f")
+inline void dot_block_avx512(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out)
+{
+    ZeroUpperOnExit zero_upper;
+    const float* tile[8];
+    for (size_t i=0; i<na; i+=8) {
+        dot_tile_rows(a, na, i, 8, tile);
+        for (size_t j=0; j<ldb; j+=16) {
+            dot_tile_avx512(tile, b+j, ldb, dim, out+i*ldb+j, na-i);
+        }
+    }
+}
+
+#endif
+
+/*
+ * Kernels for vectors of bytes. The sums are exact: they are accumulated in
+ * 32 bit integer lanes and moved into a 64 bit total after every block, so no
+ * dimension can overflow them. Squaring a difference needs 16 bit products
+ * (|a-b| goes up to 255), so the squared distance zero-extends |a-b| and uses
+ * pmaddwd; the Manhattan distance is psadbw. The signed variants flip the sign
+ * bit of both operands first, which maps them to unsigned bytes with the same
+ * differences.
+ */
+
+/**
+ * Number of bytes between two early-termination tests, the same amount of
+ * memory as kEarlyExitStride floats.
+ */
+const size_t kEarlyExitStrideBytes = 4*kEarlyExitStride;
+
+template <bool Signed>
+inline int byte_value(unsigned char v)
+{
+    return Signed ? (int)(signed char)v : (int)v;
+}
+
+template <bool Signed>
+inline unsigned long long l2_byte_sum(const unsigned char* a, const unsigned char* b, size_t begin, size_t end)
+{
+    unsigned long long sum = 0;
+    for (size_t i=begin; i<end; ++i) {
+        int diff = byte_value<Signed>(a[i])-byte_value<Signed>(b[i]);
+        sum += (unsigned int)(diff*diff);
+    }
+    return sum;
+}
+
+template <bool Signed>
+inline unsigned long long l1_byte_sum(const unsigned char* a, const unsigned char* b, size_t begin, size_t end)
+{
+    unsigned long long sum = 0;
+    for (size_t i=begin; i<end; ++i) {
+        int diff = byte_value<Signed>(a[i])-byte_value<Signed>(b[i]);
+        sum += (unsigned int)(diff<0 ? -diff : diff);
+    }
+    return sum;
+}
+
+template <bool Signed>
+inline float l2_byte_scalar(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i<size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        total += l2_byte_sum<Signed>(a, b, i, block_end);
+        i = block_end;
+        if (worst_dist>0 && i<size && total>worst_dist) break;
+    }
+    return (float)total;
+}
+
+template <bool Signed>
+inline float l1_byte_scalar(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i<size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        total += l1_byte_sum<Signed>(a, b, i, block_end);
+        i = block_end;
+        if (worst_dist>0 && i<size && total>worst_dist) break;
+    }
+    return (float)total;
+}
+
+template <bool Signed>
+FLANN_TARGET("sse2")
+inline __m128i load_bytes(const unsigned char* p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return Signed ? _mm_xor_si128(v, _mm_set1_epi8((char)0x80)) : v;
+}
+
+/**
+ * Sum of the 32 bit lanes, which must not overflow.
+ */
+FLANN_TARGET("sse2")
+inline unsigned int hsum_epu32(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (unsigned int)_mm_cvtsi128_si32(v);
+}
+
+FLANN_TARGET("avx2")
+inline unsigned int hsum256_epu32(__m256i v)
+{
+    return hsum_epu32(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+#ifdef FLANN_SIMD_AVX512
+FLANN_TARGET("avx512f")
+inline unsigned int hsum512_epu32(__m512i v)
+{
+    return hsum256_epu32(_mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, v, 0),
+                                          _mm512_maskz_extracti64x4_epi64(0xFF, v, 1)));
+}
+#endif
+
+template <bool Signed>
+FLANN_TARGET("sse2")
+inline float l2_byte_sse2(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i+16<=size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        __m128i acc = _mm_setzero_si128();
+        for (; i+16<=block_end; i+=16) {
+            __m128i va = load_bytes<Signed>(a+i);
+            __m128i vb = load_bytes<Signed>(b+i);
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        total += hsum_epu32(acc);
+        if (worst_dist>0 && i<size && total>worst_dist) return (float)total;
+    }
+    return (float)(total + l2_byte_sum<Signed>(a, b, i, size));
+}
+
+template <bool Signed>
+FLANN_TARGET("sse2")
+inline float l1_byte_sse2(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i+16<=size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        // psadbw leaves two sums in the low bits of the 64 bit lanes
+        __m128i acc = _mm_setzero_si128();
+        for (; i+16<=block_end; i+=16) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(load_bytes<Signed>(a+i), load_bytes<Signed>(b+i)));
+        }
+        total += hsum_epu32(acc);
+        if (worst_dist>0 && i<size && total>worst_dist) return (float)total;
+    }
+    return (float)(total + l1_byte_sum<Signed>(a, b, i, size));
+}
+
+template <bool Signed>
+FLANN_TARGET("avx2")
+inline __m256i load256_bytes(const unsigned char* p)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    return Signed ? _mm256_xor_si256(v, _mm256_set1_epi8((char)0x80)) : v;
+}
+
+template <bool Signed>
+FLANN_TARGET("avx2")
+inline float l2_byte_avx2(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        for (; i+32<=block_end; i+=32) {
+            __m256i va = load256_bytes<Signed>(a+i);
+            __m256i vb = load256_bytes<Signed>(b+i);
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i lo = _mm256_unpacklo_epi8(diff, zero);
+            __m256i hi = _mm256_unpackhi_epi8(diff, zero);
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(lo, lo));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(hi, hi));
+        }
+        total += hsum256_epu32(_mm256_add_epi32(acc0, acc1));
+        if (worst_dist>0 && i<size && total>worst_dist) return (float)total;
+    }
+    return (float)(total + l2_byte_sum<Signed>(a, b, i, size));
+}
+
+template <bool Signed>
+FLANN_TARGET("avx2")
+inline float l1_byte_avx2(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        __m256i acc = _mm256_setzero_si256();
+        for (; i+32<=block_end; i+=32) {
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(load256_bytes<Signed>(a+i), load256_bytes<Signed>(b+i)));
+        }
+        total += hsum256_epu32(acc);
+        if (worst_dist>0 && i<size && total>worst_dist) return (float)total;
+    }
+    return (float)(total + l1_byte_sum<Signed>(a, b, i, size));
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+/**
+ * Loads up to 64 bytes, the ones past the end read as zero. As the signed
+ * variants flip the sign bit of both operands, the padding has no effect on
+ * the distances.
+ */
+template <bool Signed>
+FLANN_TARGET("avx512f,avx512bw")
+inline __m512i load512_bytes(const unsigned char* p, size_t left)
+{
+    __mmask64 mask = left>=64 ? ~(__mmask64)0 : (((__mmask64)1<<left)-1);
+    __m512i v = _mm512_maskz_loadu_epi8(mask, p);
+    return Signed ? _mm512_xor_si512(v, _mm512_set1_epi8((char)0x80)) : v;
+}
+
+template <bool Signed>
+FLANN_TARGET("avx512f,avx512bw")
+inline float l2_byte_avx512(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    const __m512i zero = _mm512_setzero_si512();
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i<size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        for (; i<block_end; i+=64) {
+            __m512i va = load512_bytes<Signed>(a+i, block_end-i);
+            __m512i vb = load512_bytes<Signed>(b+i, block_end-i);
+            __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+            __m512i lo = _mm512_unpacklo_epi8(diff, zero);
+            __m512i hi = _mm512_unpackhi_epi8(diff, zero);
+            acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(lo, lo));
+            acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(hi, hi));
+        }
+        i = block_end;
+        total += hsum512_epu32(_mm512_add_epi32(acc0, acc1));
+        if (worst_dist>0 && i<size && total>worst_dist) break;
+    }
+    return (float)total;
+}
+
+template <bool Signed>
+FLANN_TARGET("avx512f,avx512bw")
+inline float l1_byte_avx512(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    unsigned long long total = 0;
+    size_t i = 0;
+    while (i<size) {
+        size_t block_end = i+kEarlyExitStrideBytes<size ? i+kEarlyExitStrideBytes : size;
+        __m512i acc = _mm512_setzero_si512();
+        for (; i<block_end; i+=64) {
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(load512_bytes<Signed>(a+i, block_end-i),
+                                                        load512_bytes<Signed>(b+i, block_end-i)));
+        }
+        i = block_end;
+        // psadbw leaves two sums in the low bits of the 64 bit lanes
+        total += hsum512_epu32(acc);
+        if (worst_dist>0 && i<size && total>worst_dist) break;
+    }
+    return (float)total;
+}
+
+#endif
+
+/*
+ * Kernels for the 16 bit floating point formats. The elements are widened to
+ * float as they are loaded (vcvtph2ps for half precision, a shift for
+ * bfloat16) and the sums are done in float, like in the float kernels. The
+ * second vector is in QueryFormat, which is either the format of the points
+ * or FloatFormat for the float queries searched in such points.
+ */
+
+struct HalfFormat
+{
+    typedef unsigned short Storage;
+
+    static float to_float(unsigned short bits)
+    {
+        return half_bits_to_float(bits);
+    }
+
+    FLANN_TARGET("avx,f16c")
+    static __m256 load8(const unsigned short* p)
+    {
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p));
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 load16(const unsigned short* p)
+    {
+        return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p));
+    }
+#endif
+};
+
+struct BFloat16Format
+{
+    typedef unsigned short Storage;
+
+    static float to_float(unsigned short bits)
+    {
+        return bfloat16_bits_to_float(bits);
+    }
+
+    FLANN_TARGET("avx2")
+    static __m256 load8(const unsigned short* p)
+    {
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(v, 16));
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 load16(const unsigned short* p)
+    {
+        __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(v, 16));
+    }
+#endif
+};
+
+struct FloatFormat
+{
+    typedef float Storage;
+
+    static float to_float(float value)
+    {
+        return value;
+    }
+
+    FLANN_TARGET("avx")
+    static __m256 load8(const float* p)
+    {
+        return _mm256_loadu_ps(p);
+    }
+
+#ifdef FLANN_SIMD_AVX512
+    FLANN_TARGET("avx512f")
+    static __m512 load16(const float* p)
+    {
+        return _mm512_loadu_ps(p);
+    }
+#endif
+};
+
+template <typename Format, typename QueryFormat>
+inline float l2_half_scalar(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float worst_dist)
+{
+    float result = 0;
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        float diff0 = Format::to_float(a[i])-QueryFormat::to_float(b[i]);
+        float diff1 = Format::to_float(a[i+1])-QueryFormat::to_float(b[i+1]);
+        float diff2 = Format::to_float(a[i+2])-QueryFormat::to_float(b[i+2]);
+        float diff3 = Format::to_float(a[i+3])-QueryFormat::to_float(b[i+3]);
+        result += diff0*diff0 + diff1*diff1 + diff2*diff2 + diff3*diff3;
+        if (worst_dist>0 && result>worst_dist) return result;
+    }
+    for (; i<size; ++i) {
+        float diff = Format::to_float(a[i])-QueryFormat::to_float(b[i]);
+        result += diff*diff;
+    }
+    return result;
+}
+
+template <typename Format, typename QueryFormat>
+FLANN_TARGET("avx2,fma,f16c")
+inline float l2_half_avx2(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    while (i+16<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+16<=block_end; i+=16) {
+            __m256 d0 = _mm256_sub_ps(Format::load8(a+i), QueryFormat::load8(b+i));
+            __m256 d1 = _mm256_sub_ps(Format::load8(a+i+8), QueryFormat::load8(b+i+8));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = hsum256_ps(_mm256_add_ps(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    float result = hsum256_ps(_mm256_add_ps(acc0, acc1));
+    for (; i<size; ++i) {
+        float diff = Format::to_float(a[i])-QueryFormat::to_float(b[i]);
+        result += diff*diff;
+    }
+    return result;
+}
+
+template <typename Format, typename QueryFormat>
+inline float ip_half_scalar(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float)
+{
+    float dot0 = 0, dot1 = 0, dot2 = 0, dot3 = 0;
+    size_t i = 0;
+    for (; i+4<=size; i+=4) {
+        dot0 += Format::to_float(a[i])*QueryFormat::to_float(b[i]);
+        dot1 += Format::to_float(a[i+1])*QueryFormat::to_float(b[i+1]);
+        dot2 += Format::to_float(a[i+2])*QueryFormat::to_float(b[i+2]);
+        dot3 += Format::to_float(a[i+3])*QueryFormat::to_float(b[i+3]);
+    }
+    for (; i<size; ++i) {
+        dot0 += Format::to_float(a[i])*QueryFormat::to_float(b[i]);
+    }
+    return 1-((dot0+dot1)+(dot2+dot3));
+}
+
+template <typename Format, typename QueryFormat>
+FLANN_TARGET("avx2,fma,f16c")
+inline float ip_half_avx2(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i+16<=size; i+=16) {
+        acc0 = _mm256_fmadd_ps(Format::load8(a+i), QueryFormat::load8(b+i), acc0);
+        acc1 = _mm256_fmadd_ps(Format::load8(a+i+8), QueryFormat::load8(b+i+8), acc1);
+    }
+    float dot = hsum256_ps(_mm256_add_ps(acc0, acc1));
+    for (; i<size; ++i) {
+        dot += Format::to_float(a[i])*QueryFormat::to_float(b[i]);
+    }
+    return 1-dot;
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+template <typename Format, typename QueryFormat>
+FLANN_TARGET("avx512f")
+inline float l2_half_avx512(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    while (i+32<=size) {
+        size_t block_end = i+kEarlyExitStride<size ? i+kEarlyExitStride : size;
+        for (; i+32<=block_end; i+=32) {
+            __m512 d0 = _mm512_sub_ps(Format::load16(a+i), QueryFormat::load16(b+i));
+            __m512 d1 = _mm512_sub_ps(Format::load16(a+i+16), QueryFormat::load16(b+i+16));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        }
+        if (worst_dist>0 && i<size) {
+            float partial = hsum512_ps(_mm512_add_ps(acc0, acc1));
+            if (partial>worst_dist) return partial;
+        }
+    }
+    if (i+16<=size) {
+        __m512 d0 = _mm512_sub_ps(Format::load16(a+i), QueryFormat::load16(b+i));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        i += 16;
+    }
+    float result = hsum512_ps(_mm512_add_ps(acc0, acc1));
+    for (; i<size; ++i) {
+        float diff = Format::to_float(a[i])-QueryFormat::to_float(b[i]);
+        result += diff*diff;
+    }
+    return result;
+}
+
+template <typename Format, typename QueryFormat>
+FLANN_TARGET("avx512f")
+inline float ip_half_avx512(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float)
+{
+    ZeroUpperOnExit zero_upper;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        acc0 = _mm512_fmadd_ps(Format::load16(a+i), QueryFormat::load16(b+i), acc0);
+        acc1 = _mm512_fmadd_ps(Format::load16(a+i+16), QueryFormat::load16(b+i+16), acc1);
+    }
+    if (i+16<=size) {
+        acc0 = _mm512_fmadd_ps(Format::load16(a+i), QueryFormat::load16(b+i), acc0);
+        i += 16;
+    }
+    float dot = hsum512_ps(_mm512_add_ps(acc0, acc1));
+    for (; i<size; ++i) {
+        dot += Format::to_float(a[i])*QueryFormat::to_float(b[i]);
+    }
+    return 1-dot;
+}
+
+#endif
+
+/*
+ * Hamming distance kernels, counting the bits of a^b. They take the size in
+ * bytes and ignore worst_dist: binary descriptors are a few words long, too
+ * short for an early termination to pay.
+ */
+
+inline unsigned int popcount64_scalar(unsigned long long v)
+{
+    v -= (v >> 1) & 0x5555555555555555ULL;
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    return (unsigned int)((((v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL) * 0x0101010101010101ULL) >> 56);
+}
+
+/**
+ * Loads up to 8 bytes in a word, the missing ones are zero.
+ */
+inline unsigned long long load_word(const unsigned char* p, size_t count)
+{
+    unsigned long long word = 0;
+    memcpy(&word, p, count<8 ? count : 8);
+    return word;
+}
+
+inline unsigned int hamming_scalar(const unsigned char* a, const unsigned char* b, size_t size, unsigned int)
+{
+    unsigned int result = 0;
+    for (size_t i=0; i<size; i+=8) {
+        result += popcount64_scalar(load_word(a+i, size-i) ^ load_word(b+i, size-i));
+    }
+    return result;
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+FLANN_TARGET("popcnt")
+inline unsigned int hamming_popcnt(const unsigned char* a, const unsigned char* b, size_t size, unsigned int)
+{
+    // independent counters, popcnt has a latency of 3 cycles
+    unsigned long long count0 = 0, count1 = 0, count2 = 0, count3 = 0;
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        count0 += _mm_popcnt_u64(load_word(a+i, 8) ^ load_word(b+i, 8));
+        count1 += _mm_popcnt_u64(load_word(a+i+8, 8) ^ load_word(b+i+8, 8));
+        count2 += _mm_popcnt_u64(load_word(a+i+16, 8) ^ load_word(b+i+16, 8));
+        count3 += _mm_popcnt_u64(load_word(a+i+24, 8) ^ load_word(b+i+24, 8));
+    }
+    for (; i<size; i+=8) {
+        count0 += _mm_popcnt_u64(load_word(a+i, size-i) ^ load_word(b+i, size-i));
+    }
+    return (unsigned int)((count0+count1)+(count2+count3));
+}
+
+#else
+
+FLANN_TARGET("popcnt")
+inline unsigned int hamming_popcnt(const unsigned char* a, const unsigned char* b, size_t size, unsigned int)
+{
+    unsigned int result = 0;
+    for (size_t i=0; i<size; i+=8) {
+        unsigned long long word = load_word(a+i, size-i) ^ load_word(b+i, size-i);
+        result += _mm_popcnt_u32((unsigned int)word) + _mm_popcnt_u32((unsigned int)(word >> 32));
+    }
+    return result;
+}
+
+#endif
+
+/**
+ * Counts the bits of the bytes with two lookups of a 16 entry table, one per
+ * nibble (vpshufb), then sums the byte counts with vpsadbw.
+ */
+FLANN_TARGET("avx2")
+inline __m256i popcount256_epi64(__m256i v)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_and_si256(v, low_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, low), _mm256_shuffle_epi8(table, high));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+FLANN_TARGET("avx2,popcnt")
+inline unsigned int hamming_avx2(const unsigned char* a, const unsigned char* b, size_t size, unsigned int worst_dist)
+{
+    ZeroUpperOnExit zero_upper;
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i+32<=size; i+=32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+        acc = _mm256_add_epi64(acc, popcount256_epi64(_mm256_xor_si256(va, vb)));
+    }
+    // the 64 bit lanes hold counts that fit in 32 bits
+    unsigned int result = hsum256_epu32(acc);
+    if (i<size) {
+        result += hamming_popcnt(a+i, b+i, size-i, worst_dist);
+    }
+    return result;
+}
+
+#ifdef FLANN_SIMD_AVX512
+
+FLANN_TARGET("avx512f,avx512bw,avx512vpopcntdq")
+inline unsigned int hamming_avx512(const unsigned char* a, const unsigned char* b, size_t size, unsigned int)
+{
+    ZeroUpperOnExit zero_upper;
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i=0; i<size; i+=64) {
+        size_t left = size-i;
+        __mmask64 mask = left>=64 ? ~(__mmask64)0 : (((__mmask64)1<<left)-1);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a+i);
+        __m512i vb = _mm512_maskz_loadu_epi8(mask, b+i);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_xor_si512(va, vb)));
+    }
+    // the 64 bit lanes hold counts that fit in 32 bits
+    return hsum512_epu32(acc);
+}
+
+#endif
+
+/*
+ * Kernel families: each one names the signature of its kernels and picks the
+ * best kernel for the processor.
+ */
+
+/**
+ * Squared euclidean distance on floats, Length is DynamicLength or FixedLength<N>.
+ */
+template <typename Length>
+struct L2FloatLength
+{
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &l2_float_avx512<Length>;
+#endif
+        if (features.avx2 && features.fma) return &l2_float_avx2<Length>;
+        if (features.sse2) return &l2_float_sse2<Length>;
+        return &l2_float_scalar<Length>;
+    }
+};
+
+typedef L2FloatLength<DynamicLength> L2Float;
+
+struct InnerProductFloat
+{
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &ip_float_avx512;
+#endif
+        if (features.avx2 && features.fma) return &ip_float_avx2;
+        if (features.sse2) return &ip_float_sse2;
+        return &ip_float_scalar;
+    }
+};
+
+struct CosineFloat
+{
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &cosine_float_avx512;
+#endif
+        if (features.avx2 && features.fma) return &cosine_float_avx2;
+        if (features.sse2) return &cosine_float_sse2;
+        return &cosine_float_scalar;
+    }
+};
+
+struct KLFloat
+{
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &kl_float_avx512;
+#endif
+        if (features.avx2 && features.fma) return &kl_float_avx2;
+        if (features.sse2) return &kl_float_sse2;
+        return &kl_float_scalar;
+    }
+};
+
+/**
+ * Distances with one term per element on floats, Op is AbsDiffOp, MaxAbsDiffOp,
+ * PowAbsDiffOp<Order>, MinOp or ChiSquareOp.
+ */
+template <typename Op>
+struct ElementwiseFloat
+{
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &elementwise_float_avx512<Op>;
+#endif
+        if (features.avx2) return &elementwise_float_avx2<Op>;
+        if (features.sse2) return &elementwise_float_sse2<Op>;
+        return &elementwise_float_scalar<Op>;
+    }
+};
+
+struct L2_3DBlockFloat
+{
+    typedef void (*Function)(const float* vec, const float* block, size_t count, size_t stride, float* dists);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &l2_3d_block_avx512;
+#endif
+        if (features.avx2 && features.fma) return &l2_3d_block_avx2;
+        if (features.sse2) return &l2_3d_block_sse2;
+        return &l2_3d_block_scalar;
+    }
+};
+
+struct DotBlockFloat
+{
+    typedef void (*Function)(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &dot_block_avx512;
+#endif
+        if (features.avx2 && features.fma) return &dot_block_avx2;
+        if (features.sse2) return &dot_block_sse2;
+        return &dot_block_scalar;
+    }
+};
+
+/**
+ * Byte kernels; Signed selects the variant for signed bytes.
+ */
+template <bool Signed>
+struct L2Byte
+{
+    typedef float (*Function)(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512bw) return &l2_byte_avx512<Signed>;
+#endif
+        if (features.avx2) return &l2_byte_avx2<Signed>;
+        if (features.sse2) return &l2_byte_sse2<Signed>;
+        return &l2_byte_scalar<Signed>;
+    }
+};
+
+template <bool Signed>
+struct L1Byte
+{
+    typedef float (*Function)(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512bw) return &l1_byte_avx512<Signed>;
+#endif
+        if (features.avx2) return &l1_byte_avx2<Signed>;
+        if (features.sse2) return &l1_byte_sse2<Signed>;
+        return &l1_byte_scalar<Signed>;
+    }
+};
+
+/**
+ * Kernels of the 16 bit floating point formats, Format is HalfFormat or
+ * BFloat16Format. The second vector is in the same format, or in float with
+ * QueryFormat FloatFormat.
+ */
+template <typename Format, typename QueryFormat = Format>
+struct L2Half
+{
+    typedef float (*Function)(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &l2_half_avx512<Format, QueryFormat>;
+#endif
+        if (features.avx2 && features.fma && features.f16c) return &l2_half_avx2<Format, QueryFormat>;
+        return &l2_half_scalar<Format, QueryFormat>;
+    }
+};
+
+template <typename Format, typename QueryFormat = Format>
+struct InnerProductHalf
+{
+    typedef float (*Function)(const unsigned short* a, const typename QueryFormat::Storage* b, size_t size, float worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512f) return &ip_half_avx512<Format, QueryFormat>;
+#endif
+        if (features.avx2 && features.fma && features.f16c) return &ip_half_avx2<Format, QueryFormat>;
+        return &ip_half_scalar<Format, QueryFormat>;
+    }
+};
+
+struct HammingBytes
+{
+    typedef unsigned int (*Function)(const unsigned char* a, const unsigned char* b, size_t size, unsigned int worst_dist);
+
+    static Function select(const CpuFeatures& features)
+    {
+#ifdef FLANN_SIMD_AVX512
+        if (features.avx512vpopcntdq && features.avx512bw) return &hamming_avx512;
+#endif
+        if (features.avx2 && features.popcnt) return &hamming_avx2;
+        if (features.popcnt) return &hamming_popcnt;
+        return &hamming_scalar;
+    }
+};
+
+/**
+ * Holds the kernel of a family selected for the processor. The pointer starts
+ * on a function that makes the selection on the first call (so there is no
+ * dependency on the order of static initialization). It is atomic, as the
+ * threads of a batch search may race on the first call; they all store the
+ * same value.
+ */
+template <typename Family>
+struct KernelDispatch
+{
+    typedef typename Family::Function Function;
+
+    static std::atomic<Function> function;
+
+    static Function get()
+    {
+        return function.load(std::memory_order_relaxed);
+    }
+
+    template <typename ElementType1, typename ElementType2, typename ResultType>
+    static ResultType resolve(const ElementType1* a, const ElementType2* b, size_t size, ResultType worst_dist)
+    {
+        Function selected = Family::select(detect_cpu_features());
+        function.store(selected, std::memory_order_relaxed);
+        return selected(a, b, size, worst_dist);
+    }
+    template <typename ElementType, typename ResultType>
+    static void resolve(const ElementType* vec, const ElementType* block, size_t count, size_t stride, ResultType* dists)
+    {
+        Function selected = Family::select(detect_cpu_features());
+        function.store(selected, std::memory_order_relaxed);
+        selected(vec, block, count, stride, dists);
+    }
+
+    template <typename ElementType, typename ResultType>
+    static void resolve(const ElementType* const* a, size_t na, const ElementType* b, size_t ldb, size_t dim, ResultType* out)
+    {
+        Function selected = Family::select(detect_cpu_features());
+        function.store(selected, std::memory_order_relaxed);
+        selected(a, na, b, ldb, dim, out);
+    }
+};
+
+template <typename Family>
+std::atomic<typename KernelDispatch<Family>::Function> KernelDispatch<Family>::function(&KernelDispatch<Family>::resolve);
+
+}
+
+template <>
+struct L2Kernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Float>::get()(a, b, size, worst_dist);
+    }
+};
+
+template <size_t N>
+struct L2FixedKernel<float, N>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2FloatLength<simd::FixedLength<N> > >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct InnerProductKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::InnerProductFloat>::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct CosineKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::CosineFloat>::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct KLKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::KLFloat>::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct L1Kernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::ElementwiseFloat<simd::AbsDiffOp> >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct MaxKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::ElementwiseFloat<simd::MaxAbsDiffOp> >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct HistIntersectionKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::ElementwiseFloat<simd::MinOp> >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct ChiSquareKernel<float>
+{
+    static const bool available = true;
+
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::ElementwiseFloat<simd::ChiSquareOp> >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct L2_3DBlockKernel<float>
+{
+    static const bool available = true;
+
+    static void apply(const float* vec, const float* block, size_t count, size_t stride, float* dists)
+    {
+        simd::KernelDispatch<simd::L2_3DBlockFloat>::get()(vec, block, count, stride, dists);
+    }
+};
+
+/**
+ * Orders 1 and 2 use the Manhattan and squared euclidean kernels.
+ */
+template <>
+struct MinkowskiKernel<float>
+{
+    static const bool available = true;
+
+    typedef float (*Function)(const float* a, const float* b, size_t size, float worst_dist);
+
+    static Function select(int order)
+    {
+        switch (order) {
+        case 1: return &L1Kernel<float>::apply;
+        case 2: return &L2Kernel<float>::apply;
+        case 3: return &MinkowskiKernel::apply<3>;
+        case 4: return &MinkowskiKernel::apply<4>;
+        default: return NULL;
+        }
+    }
+
+    template <int Order>
+    static float apply(const float* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::ElementwiseFloat<simd::PowAbsDiffOp<Order> > >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct L2Kernel<unsigned char>
+{
+    static const bool available = true;
+
+    static float apply(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Byte<false> >::get()(a, b, size, worst_dist);
+    }
+};
+
+/*
+ * Plain char is signed or not depending on the compiler options.
+ */
+template <>
+struct L2Kernel<char>
+{
+    static const bool available = true;
+
+    static float apply(const char* a, const char* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Byte<(CHAR_MIN<0)> >::get()(
+                (const unsigned char*)a, (const unsigned char*)b, size, worst_dist);
+    }
+};
+
+template <>
+struct L1Kernel<unsigned char>
+{
+    static const bool available = true;
+
+    static float apply(const unsigned char* a, const unsigned char* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L1Byte<false> >::get()(a, b, size, worst_dist);
+    }
+};
+
+template <>
+struct L1Kernel<char>
+{
+    static const bool available = true;
+
+    static float apply(const char* a, const char* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L1Byte<(CHAR_MIN<0)> >::get()(
+                (const unsigned char*)a, (const unsigned char*)b, size, worst_dist);
+    }
+};
+
+template <>
+struct L2Kernel<float16>
+{
+    static const bool available = true;
+
+    static float apply(const float16* a, const float16* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Half<simd::HalfFormat> >::get()(
+                (const unsigned short*)a, (const unsigned short*)b, size, worst_dist);
+    }
+
+    static float apply(const float16* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Half<simd::HalfFormat, simd::FloatFormat> >::get()(
+                (const unsigned short*)a, b, size, worst_dist);
+    }
+
+    static float apply(const float* a, const float16* b, size_t size, float worst_dist)
+    {
+        return apply(b, a, size, worst_dist);
+    }
+};
+
+template <>
+struct InnerProductKernel<float16>
+{
+    static const bool available = true;
+
+    static float apply(const float16* a, const float16* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::InnerProductHalf<simd::HalfFormat> >::get()(
+                (const unsigned short*)a, (const unsigned short*)b, size, worst_dist);
+    }
+
+    static float apply(const float16* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::InnerProductHalf<simd::HalfFormat, simd::FloatFormat> >::get()(
+                (const unsigned short*)a, b, size, worst_dist);
+    }
+
+    static float apply(const float* a, const float16* b, size_t size, float worst_dist)
+    {
+        return apply(b, a, size, worst_dist);
+    }
+};
+
+template <>
+struct L2Kernel<bfloat16>
+{
+    static const bool available = true;
+
+    static float apply(const bfloat16* a, const bfloat16* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Half<simd::BFloat16Format> >::get()(
+                (const unsigned short*)a, (const unsigned short*)b, size, worst_dist);
+    }
+
+    static float apply(const bfloat16* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::L2Half<simd::BFloat16Format, simd::FloatFormat> >::get()(
+                (const unsigned short*)a, b, size, worst_dist);
+    }
+
+    static float apply(const float* a, const bfloat16* b, size_t size, float worst_dist)
+    {
+        return apply(b, a, size, worst_dist);
+    }
+};
+
+template <>
+struct InnerProductKernel<bfloat16>
+{
+    static const bool available = true;
+
+    static float apply(const bfloat16* a, const bfloat16* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::InnerProductHalf<simd::BFloat16Format> >::get()(
+                (const unsigned short*)a, (const unsigned short*)b, size, worst_dist);
+    }
+
+    static float apply(const bfloat16* a, const float* b, size_t size, float worst_dist)
+    {
+        return simd::KernelDispatch<simd::InnerProductHalf<simd::BFloat16Format, simd::FloatFormat> >::get()(
+                (const unsigned short*)a, b, size, worst_dist);
+    }
+
+    static float apply(const float* a, const bfloat16* b, size_t size, float worst_dist)
+    {
+        return apply(b, a, size, worst_dist);
+    }
+};
+
+template <>
+struct HammingKernel<unsigned char>
+{
+    static const bool available = true;
+
+    static unsigned int apply(const unsigned char* a, const unsigned char* b, size_t size, unsigned int worst_dist)
+    {
+        return simd::KernelDispatch<simd::HammingBytes>::get()(a, b, size, worst_dist);
+    }
+};
+
+#endif /* FLANN_SIMD_X86 */
+
+/**
+ * Number of vectors dot_block() handles at a time, the stride of the vectors
+ * it multiplies stored by coordinate is a multiple of it.
+ */
+const size_t kDotBlockWidth = 16;
+
+/**
+ * Stride to store count vectors by coordinate for dot_block()
+ */
+inline size_t dot_block_stride(size_t count)
+{
+    return (count+kDotBlockWidth-1)/kDotBlockWidth*kDotBlockWidth;
+}
+
+/**
+ * Computes the dot products between two sets of vectors.
+ *
+ * @param a the first set of vectors
+ * @param na number of vectors in a
+ * @param b the second set of vectors, stored by coordinate: b[k*ldb+j] is
+ *          coordinate k of vector j and the vectors past the last one are zeros
+ * @param ldb stride of b, see dot_block_stride()
+ * @param dim length of the vectors
+ * @param out output, out[i*ldb+j] is the dot product of a[i] and vector j of b
+ */
+inline void dot_block(const float* const* a, size_t na, const float* b, size_t ldb, size_t dim, float* out)
+{
+#ifdef FLANN_SIMD_X86
+    simd::KernelDispatch<simd::DotBlockFloat>::get()(a, na, b, ldb, dim, out);
+#else
+    for (size_t i=0; i<na; ++i) {
+        float* row = out+i*ldb;
+        for (size_t j=0; j<ldb; ++j) row[j] = 0;
+        for (size_t k=0; k<dim; ++k) {
+            float x = a[i][k];
+            const float* coords = b+k*ldb;
+            for (size_t j=0; j<ldb; ++j) row[j] += x*coords[j];
+        }
+    }
+#endif
+}
+
+}
+
+#endif /* FLANN_DIST_SIMD_H_ */
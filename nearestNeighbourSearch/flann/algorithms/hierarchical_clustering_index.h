@@ -46,19 +46,74 @@
 #include "../util/matrix.h"
 #include "../util/result_set.h"
 #include "../util/heap.h"
+#include "../util/visited_set.h"
 #include "../util/allocator.h"
 #include "../util/random.h"
 #include "../util/saving.h"
 #include "../util/serialization.h"
+#include "../util/timer.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace flann
 {
 
+/**
+ * Alignment (in bytes) of the per-node pivot blocks
+ */
+#define PIVOT_BLOCK_ALIGNMENT 64
+
+/**
+ * Alignment (in bytes) of the vectors stored in packed leaves
+ */
+#define LEAF_DATA_ALIGNMENT 64
+
+/**
+ * Number of branches a time-bounded search pops from its queue between two
+ * reads of the clock
+ */
+#define DEADLINE_CHECK_INTERVAL 8
+
+/**
+ * Smallest cluster the index build clusters in a task of its own
+ */
+#define CLUSTERING_TASK_MIN_POINTS 4096
+
+/**
+ * Number of points the index build labels in a task of its own
+ */
+#define LABELS_CHUNK_POINTS 4096
+
+/**
+ * Number of points labeled together, their distances to the centers come
+ * from one block of dot products when the distance allows it
+ */
+#define LABELS_BLOCK_POINTS 64
+
+/**
+ * Default number of points per center the center choosers sample from large
+ * nodes: 0, all the points, so that the trees are the ones earlier versions
+ * built. Around 64 cuts the k-means++ and group-wise builds several times for
+ * a small change of the trees (and of the recall, either way).
+ */
+#define CENTERS_SAMPLE_PER_CENTER 0
+
+/*
+ * The build runs the large clusters as OpenMP tasks (OpenMP 3.0), and with
+ * older OpenMP versions (e.g. MSVC) only builds the trees in parallel.
+ */
+#if defined(_OPENMP) && _OPENMP >= 200805
+#define FLANN_OMP_TASKS
+#endif
+
 struct MultiThreadHierarchicalIndexParams : public IndexParams
 {
     MultiThreadHierarchicalIndexParams(int branching = 32,
                                       flann_centers_init_t centers_init = FLANN_CENTERS_RANDOM,
-                                      int trees = 4, int leaf_max_size = 100)
+                                      int trees = 4, int leaf_max_size = 100,
+                                      bool pack_leaves = false, bool pretransform = false)
     {
         (*this)["algorithm"] = FLANN_INDEX_MULTITHREAD;
         // The branching factor used in the hierarchical clustering
@@ -69,6 +124,17 @@ struct MultiThreadHierarchicalIndexParams : public IndexParams
         (*this)["trees"] = trees;
         // maximum leaf size
         (*this)["leaf_max_size"] = leaf_max_size;
+        // store a copy of the points' vectors inside each leaf (by coordinate for
+        // the distances computed on whole leaves, e.g. L2_3D for point clouds)
+        (*this)["pack_leaves"] = pack_leaves;
+        // store the points transformed for a cheaper distance (e.g. normalized for Cosine)
+        (*this)["pretransform"] = pretransform;
+        // number of threads building the index (0 for all the available ones)
+        (*this)["cores"] = 0;
+        // the k-means++ and group-wise center choosers pick the k centers of larger
+        // nodes among a random sample of k*centers_sample points (0 for all, e.g. 64
+        // for faster builds of large indices, which changes the trees)
+        (*this)["centers_sample"] = CENTERS_SAMPLE_PER_CENTER;
     }
 };
 
@@ -88,6 +154,8 @@ public:
     typedef typename Distance::ResultType DistanceType;
 
     typedef NNIndex<Distance> BaseClass;
+    typedef typename BaseClass::QueryElementType QueryElementType;
+    typedef typename BaseClass::ScopedSearchContext ScopedSearchContext;
 
     /**
      * Constructor.
@@ -104,6 +172,17 @@ public:
         centers_init_ = get_param(index_params_, "centers_init", FLANN_CENTERS_GROUPWISE);
         trees_ = get_param(index_params_,"trees",4);
         leaf_max_size_ = get_param(index_params_,"leaf_max_size",100);
+        pack_leaves_ = get_param(index_params_,"pack_leaves",false);
+        pretransform_ = get_param(index_params_,"pretransform",false);
+        cores_ = get_param(index_params_,"cores",0);
+        centers_sample_ = get_param(index_params_,"centers_sample",CENTERS_SAMPLE_PER_CENTER);
+
+        if (pretransform_) {
+            if (!distance_pretransform<Distance>::available) {
+                throw FLANNException("The distance used has no pretransform");
+            }
+            distance_ = distance_pretransform<Distance>::transformed(distance_);
+        }
 
         initCenterChooser();
     }
@@ -113,9 +192,22 @@ public:
     		branching_(other.branching_),
     		trees_(other.trees_),
     		centers_init_(other.centers_init_),
-    		leaf_max_size_(other.leaf_max_size_)
+    		leaf_max_size_(other.leaf_max_size_),
+    		pack_leaves_(other.pack_leaves_),
+    		pretransform_(other.pretransform_),
+    		cores_(other.cores_),
+    		centers_sample_(other.centers_sample_)
 
     {
+    	if (!other.pretransformed_data_.empty()) {
+    		// the points live in the other index's storage
+    		ElementType* data = new ElementType[size_*veclen_];
+    		for (size_t i=0;i<size_;++i) {
+    			std::copy(points_[i], points_[i]+veclen_, data+i*veclen_);
+    			points_[i] = data+i*veclen_;
+    		}
+    		pretransformed_data_.push_back(data);
+    	}
     	initCenterChooser();
         tree_roots_.resize(other.tree_roots_.size());
         for (size_t i=0;i<tree_roots_.size();++i) {
@@ -132,22 +224,33 @@ public:
 
     void initCenterChooser()
     {
+        chooseCenters_ = createCenterChooser();
+    }
+
+    /**
+     * Creates a center chooser of the type given by centers_init_, the caller owns it.
+     */
+    CenterChooser<Distance>* createCenterChooser() const
+    {
+        CenterChooser<Distance>* chooser;
         switch(centers_init_) {
         case FLANN_CENTERS_RANDOM:
-        	chooseCenters_ = new RandomCenterChooser<Distance>(distance_, points_);
+        	chooser = new RandomCenterChooser<Distance>(distance_, points_);
         	break;
         case FLANN_CENTERS_GONZALES:
-        	chooseCenters_ = new GonzalesCenterChooser<Distance>(distance_, points_);
+        	chooser = new GonzalesCenterChooser<Distance>(distance_, points_);
         	break;
         case FLANN_CENTERS_KMEANSPP:
-            chooseCenters_ = new KMeansppCenterChooser<Distance>(distance_, points_);
-        	break;
+            chooser = new KMeansppCenterChooser<Distance>(distance_, points_);
+            break;
         case FLANN_CENTERS_GROUPWISE:
-            chooseCenters_ = new GroupWiseCenterChooser<Distance>(distance_, points_);
+            chooser = new GroupWiseCenterChooser<Distance>(distance_, points_);
             break;
         default:
             throw FLANNException("Unknown algorithm for choosing initial centers.");
         }
+        chooser->setSampleSize(centers_sample_);
+        return chooser;
     }
 
     /**
@@ -159,6 +262,9 @@ public:
     {
     	delete chooseCenters_;
     	freeIndex();
+    	for (size_t i=0;i<pretransformed_data_.size();++i) {
+    		delete[] pretransformed_data_[i];
+    	}
     }
 
     BaseClass* clone() const
@@ -172,7 +278,11 @@ public:
      */
     int usedMemory() const
     {
-        return pool_.usedMemory+pool_.wastedMemory+memoryCounter_;
+        int memory = pool_.usedMemory+pool_.wastedMemory+memoryCounter_;
+        for (size_t i=0; i<build_pools_.size(); ++i) {
+            memory += build_pools_[i]->usedMemory+build_pools_[i]->wastedMemory;
+        }
+        return memory;
     }
     
     using BaseClass::buildIndex;
@@ -182,7 +292,20 @@ public:
         assert(veclen_ == 0 || points.cols == veclen_);
         size_t old_size = size_;
 
-        vector<size_t> vec_ret=extendDataset(points);
+        std::vector<size_t> vec_ret;
+        if (pretransform_) {
+            // the index keeps its own transformed copy of the points
+            ElementType* data = new ElementType[points.rows*points.cols];
+            pretransformed_data_.push_back(data);
+            for (size_t i = 0; i < points.rows; ++i) {
+                std::copy(points[i], points[i]+points.cols, data+i*points.cols);
+                distance_pretransform<Distance>::apply(distance_, data+i*points.cols, points.cols);
+            }
+            vec_ret = extendDataset(Matrix<ElementType>(data, points.rows, points.cols));
+        }
+        else {
+            vec_ret = extendDataset(points);
+        }
 
         if (rebuild_threshold > 1 && size_at_build_*rebuild_threshold < size_) {
             buildIndex();
@@ -217,9 +340,17 @@ public:
     	ar & trees_;
     	ar & centers_init_;
     	ar & leaf_max_size_;
+    	ar & pack_leaves_;
+    	ar & pretransform_;
 
     	if (Archive::is_loading::value) {
     		tree_roots_.resize(trees_);
+    		if (pretransform_) {
+    			// the saved dataset is already transformed
+    			distance_ = distance_pretransform<Distance>::transformed(distance_);
+    			delete chooseCenters_;
+    			initCenterChooser();
+    		}
     	}
 
         
@@ -236,6 +367,8 @@ public:
             index_params_["trees"] = trees_;
             index_params_["centers_init"] = centers_init_;
             index_params_["leaf_size"] = leaf_max_size_;
+            index_params_["pack_leaves"] = pack_leaves_;
+            index_params_["pretransform"] = pretransform_;
     	}
     }
 
@@ -263,16 +396,42 @@ public:
      *     searchParams = parameters that influence the search algorithm (checks)
      */
 
-    void findNeighbors(ResultSet<DistanceType>& result, const ElementType* vec, const SearchParams& searchParams) const
+    void findNeighbors(ResultSet<DistanceType>& result, const QueryElementType* vec, const SearchParams& searchParams) const
+    {
+        ScopedSearchContext context(*this, searchParams);
+        findNeighbors(result, vec, searchParams, context.get());
+    }
+
+    void findNeighbors(ResultSet<DistanceType>& result, const QueryElementType* vec, const SearchParams& searchParams,
+                       SearchContextBase* context) const
     {
+        SearchContext& ctx = *static_cast<SearchContext*>(context);
+        ctx.reset();
+        if (pretransform_) {
+            ctx.query.assign(vec, vec+veclen_);
+            distance_pretransform<Distance>::apply(distance_, &ctx.query[0], veclen_);
+            vec = &ctx.query[0];
+        }
     	if (removed_) {
-    		findNeighborsWithRemoved<true>(result, vec, searchParams);
+    		findNeighborsWithRemoved<true>(result, vec, searchParams, ctx);
     	}
     	else {
-    		findNeighborsWithRemoved<false>(result, vec, searchParams);
+    		findNeighborsWithRemoved<false>(result, vec, searchParams, ctx);
     	}
     }
 
+    SearchContextBase* createSearchContext(const SearchParams& searchParams) const
+    {
+        return new SearchContext(size_, maxBranches(searchParams), expectedChecks(searchParams), branching_);
+    }
+
+    bool searchContextFits(const SearchContextBase* context, const SearchParams& searchParams) const
+    {
+        const SearchContext& ctx = *static_cast<const SearchContext*>(context);
+        return ctx.size==size_ && ctx.max_branches==maxBranches(searchParams) &&
+               ctx.expected_checks==expectedChecks(searchParams) && ctx.branching==branching_;
+    }
+
 protected:
 
     /**
@@ -280,24 +439,72 @@ protected:
      */
     void buildIndexImpl()
     {
-        chooseCenters_->setDataSize(veclen_);
-
         if (branching_<2) {
             throw FLANNException("Branching factor must be at least 2");
         }
+
+        // the seeds come from the global generator, so the trees only depend on
+        // seed_random() and not on the threads that build them
+        std::vector<unsigned int> seeds(trees_);
+        for (int i=0; i<trees_; ++i) {
+            seeds[i] = (unsigned int)rand_int();
+        }
+        chooseCenters_->setDataSize(veclen_);
+        chooseCenters_->seed((unsigned int)rand_int());
+
+        // the trees share only the read-only points, and the clusters of a tree
+        // only the parts of the indices array they own
         tree_roots_.resize(trees_);
-        std::vector<int> indices(size_);
+        for (int i=0; i<trees_; ++i) {
+            tree_roots_[i] = new(pool_) Node();
+        }
+#ifdef FLANN_OMP_TASKS
+        int threads = buildThreads();
+#else
+        int threads = std::min(trees_, buildThreads());
+#endif
+        // one memory pool per thread for the nodes (freeIndex() has emptied
+        // build_pools_), see threadBuildPool(); after the reserve the
+        // push_back cannot throw and leak a pool
+        build_pools_.reserve(threads);
+        for (int i=0; i<threads; ++i) {
+            PooledAllocator* pool = new PooledAllocator();
+            build_pools_.push_back(pool);
+        }
+
+        bool failed = false;
+#ifdef FLANN_OMP_TASKS
+#pragma omp parallel num_threads(threads)
+#pragma omp single
         for (int i=0; i<trees_; ++i)
         {
-            for (size_t j=0; j<size_; ++j) 
-            {
-                indices[j] = j;
-            }
-            tree_roots_[i] = new(pool_) Node();
-            computeClustering(tree_roots_[i], &indices[0], size_);
+#pragma omp task firstprivate(i)
+            buildTree(i, seeds[i], &failed);
+        }
+#else
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+        for (int i=0; i<trees_; ++i)
+        {
+            buildTree(i, seeds[i], &failed);
+        }
+#endif
+        if (failed) {
+            throw std::bad_alloc();
         }
     }
 
+    /**
+     * Number of threads used to build the index.
+     */
+    int buildThreads() const
+    {
+#ifdef _OPENMP
+        return cores_>0 ? cores_ : omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
 //private:
 protected:
     struct PointInfo
@@ -329,20 +536,43 @@ protected:
      */
     struct Node
     {
-        Node() :pivot(NULL), pivot_index(0){};
+        Node() :pivot(NULL), pivot_index(0), radius(0), pivots(NULL), point_data(NULL), point_data_capacity(0){};
         /**
          * The cluster center
          */
     	ElementType* pivot;
     	size_t pivot_index;
+        /**
+         * Covering radius: largest distance (in metric space) from the pivot to
+         * a point under the node (only maintained for metric distances)
+         */
+        DistanceType radius;
         /**
          * Child nodes (only for non-terminal nodes)
          */
         std::vector<Node*> childs;
+        /**
+         * Copy of the childs' pivots, stored one after the other in an aligned
+         * block so that a query is routed through the node with a single
+         * streaming pass (only for non-terminal nodes, allocated from the pool).
+         * Stored by coordinate when the distance has a soa_block_distance.
+         */
+        ElementType* pivots;
         /**
          * Node points (only for terminal nodes)
          */
         std::vector<PointInfo> points;
+        /**
+         * Copy of the points' vectors, in the order of points (only for terminal
+         * nodes of an index with packed leaves). The vectors are stored one after
+         * the other, or by coordinate with a stride of point_data_capacity when
+         * the distance has a soa_block_distance.
+         */
+        ElementType* point_data;
+        /**
+         * Number of vectors point_data has room for
+         */
+        size_t point_data_capacity;
 
         /**
          * destructor
@@ -353,6 +583,7 @@ protected:
         	for(size_t i=0; i<childs.size(); i++){
         		childs[i]->~Node();
         	}
+        	free_aligned(point_data);
         };
 
     private:
@@ -365,6 +596,7 @@ protected:
     		if (Archive::is_loading::value) {
     			pivot = obj->points_[pivot_index];
     		}
+    		ar & radius;
     		size_t childs_size;
     		if (Archive::is_saving::value) {
     			childs_size = childs.size();
@@ -373,6 +605,9 @@ protected:
 
     		if (childs_size==0) {
     			ar & points;
+    			if (Archive::is_loading::value && obj->pack_leaves_) {
+    				obj->packLeafPoints(this);
+    			}
     		}
     		else {
     			if (Archive::is_loading::value) {
@@ -384,6 +619,9 @@ protected:
     				}
     				ar & *childs[i];
     			}
+    			if (Archive::is_loading::value) {
+    				obj->buildPivotBlock(this, obj->pool_);
+    			}
     		}
 
     	}
@@ -394,10 +632,151 @@ protected:
 
 
     /**
-     * Alias definition for a nicer syntax.
+     * Branch left for later in the best-bin-first search. It is ordered by the
+     * distance from the query to the pivot and also carries a lower bound on the
+     * distance (in metric space) from the query to any point below the node.
+     */
+    struct BranchSt
+    {
+        NodePtr node;
+        DistanceType mindist;
+        DistanceType bound;
+
+        BranchSt() : node(NULL), mindist(0), bound(0) {}
+        BranchSt(const NodePtr& aNode, DistanceType dist, DistanceType aBound) : node(aNode), mindist(dist), bound(aBound) {}
+
+        bool operator<(const BranchSt& rhs) const
+        {
+            return mindist<rhs.mindist;
+        }
+    };
+
+    typedef metric_distance<Distance> Metric;
+
+    /**
+     * What one task needs to build (part of) a tree: a center chooser, which
+     * has its own random numbers, a memory pool for the nodes and scratch
+     * buffers reused by all the nodes the task clusters.
      */
-    typedef BranchStruct<NodePtr, DistanceType> BranchSt;
+    struct BuildContext
+    {
+        BuildContext(CenterChooser<Distance>& chooser, PooledAllocator& pool, unsigned int seed, bool* failed) :
+            chooseCenters(chooser), pool(pool), random(seed ^ 0x5bd1e995), failed(failed) {}
+
+        CenterChooser<Distance>& chooseCenters;
+        PooledAllocator& pool;
+        /**
+         * Seeds of the tasks started from this one
+         */
+        RandomStream random;
+        /**
+         * Set when a task of the build ran out of memory
+         */
+        bool* failed;
+        /**
+         * Scratch buffers of computeClustering(), only used until the node is
+         * partitioned, so the recursion can reuse them
+         */
+        std::vector<int> centers;
+        std::vector<int> labels;
+        std::vector<int> partition;
+        /**
+         * Scratch buffers of computeLabels()
+         */
+        std::vector<const ElementType*> center_points;
+        std::vector<ElementType> center_block;
+        std::vector<DistanceType> center_norms;
+        std::vector<ElementType> shifted_centers;
+        std::vector<const ElementType*> shifted_center_points;
+        std::vector<ElementType> shifted_points;
+        std::vector<DistanceType> chunk_costs;
+        std::vector<DistanceType> dists;
+        /**
+         * The cluster bounds of every node on the path computeClustering() is
+         * recursing down, branching+1 entries each
+         */
+        std::vector<int> child_starts;
+    };
+
+    typedef soa_block_distance<Distance> SoaBlock;
+    typedef dot_expansion<Distance> Expansion;
 
+    /**
+     * The centers computeLabels() assigns the points to
+     */
+    struct CenterSet
+    {
+        const ElementType* const* points;
+        /**
+         * Expansion::prepare() of the centers, when the expansion is available
+         */
+        const ElementType* block;
+        const DistanceType* norms;
+        /**
+         * When the expansion is translation invariant, the vector subtracted
+         * from the centers before prepare(), and the largest squared norm of
+         * the results
+         */
+        const ElementType* origin;
+        DistanceType max_norm;
+        int count;
+    };
+
+    /**
+     * Scratch state of one search thread, reused across the queries it handles.
+     */
+    struct SearchContext : public SearchContextBase
+    {
+        SearchContext(size_t size, size_t max_branches, size_t expected_checks, int branching) :
+            size(size), max_branches(max_branches), expected_checks(expected_checks), branching(branching),
+            heap(max_branches), checked(size, expected_checks), domain_distances(branching), bound_scale(1) {}
+
+        /**
+         * Prepares the context for a new query.
+         */
+        void reset()
+        {
+            // also gives back the storage the previous query grew the queue to
+            heap.clear();
+            checked.clear();
+        }
+
+        /**
+         * Index size and search parameters the context was created for
+         */
+        size_t size;
+        size_t max_branches;
+        size_t expected_checks;
+        int branching;
+
+        /**
+         * Priority queue storing intermediate branches in the best-bin-first search,
+         * when full the farthest branch is dropped (unbounded without a checks limit)
+         */
+        BoundedHeap<BranchSt> heap;
+        /**
+         * Points already checked by the current query
+         */
+        VisitedSet checked;
+        /**
+         * Distances from the query to the children of the node being descended
+         */
+        std::vector<DistanceType> domain_distances;
+        /**
+         * Branches are pruned when their lower bound times this factor, 1+eps,
+         * exceeds the current worst distance
+         */
+        float bound_scale;
+        /**
+         * Transformed copy of the query (for an index with pretransform)
+         */
+        std::vector<QueryElementType> query;
+        /**
+         * Distances from the query to the points of the leaf being scanned (for
+         * packed leaves stored by coordinate)
+         */
+        std::vector<DistanceType> leaf_distances;
+    };
 
     /**
      * Clears Node tree
@@ -408,6 +787,10 @@ protected:
     		tree_roots_[i]->~Node();
     	}
     	pool_.free();
+    	for (size_t i=0; i<build_pools_.size(); ++i) {
+    		delete build_pools_[i];
+    	}
+    	build_pools_.clear();
     }
 
     void copyTree(NodePtr& dst, const NodePtr& src)
@@ -415,39 +798,365 @@ protected:
     	dst = new(pool_) Node();
     	dst->pivot_index = src->pivot_index;
     	dst->pivot = points_[dst->pivot_index];
+    	dst->radius = src->radius;
 
     	if (src->childs.size()==0) {
     		dst->points = src->points;
+    		if (pack_leaves_) {
+    			packLeafPoints(dst);
+    		}
     	}
     	else {
     		dst->childs.resize(src->childs.size());
     		for (size_t i=0;i<src->childs.size();++i) {
     			copyTree(dst->childs[i], src->childs[i]);
     		}
+    		buildPivotBlock(dst, pool_);
     	}
     }
 
+    /**
+     * Copies the vectors of a leaf's points into the leaf's own storage.
+     */
+    void packLeafPoints(NodePtr node)
+    {
+        free_aligned(node->point_data);
+        node->point_data = NULL;
+        node->point_data_capacity = 0;
+        if (node->points.empty()) return;
+
+        node->point_data_capacity = node->points.size();
+        node->point_data = allocate_aligned<ElementType>(node->point_data_capacity*veclen_, LEAF_DATA_ALIGNMENT);
+        for (size_t i=0; i<node->points.size(); ++i) {
+            storeLeafPoint(node, i, node->points[i].point);
+        }
+    }
+
+    /**
+     * Appends the vector of the last point added to a leaf to the leaf's own storage.
+     */
+    void appendLeafPoint(NodePtr node)
+    {
+        size_t count = node->points.size();
+        if (count > node->point_data_capacity) {
+            size_t capacity = std::max(2*node->point_data_capacity, size_t(leaf_max_size_));
+            ElementType* data = allocate_aligned<ElementType>(capacity*veclen_, LEAF_DATA_ALIGNMENT);
+            if (node->point_data != NULL && !SoaBlock::available) {
+                std::copy(node->point_data, node->point_data+(count-1)*veclen_, data);
+            }
+            free_aligned(node->point_data);
+            node->point_data = data;
+            node->point_data_capacity = capacity;
+            if (SoaBlock::available) {
+                // the stride between the coordinates changed with the capacity
+                for (size_t i=0; i+1<count; ++i) {
+                    storeLeafPoint(node, i, node->points[i].point);
+                }
+            }
+        }
+        storeLeafPoint(node, count-1, node->points[count-1].point);
+    }
+
+    /**
+     * Writes the vector of a leaf's i-th point into the leaf's storage.
+     */
+    void storeLeafPoint(NodePtr node, size_t i, const ElementType* point)
+    {
+        if (SoaBlock::available) {
+            for (size_t j=0; j<veclen_; ++j) {
+                node->point_data[j*node->point_data_capacity+i] = point[j];
+            }
+        }
+        else {
+            std::copy(point, point+veclen_, node->point_data+i*veclen_);
+        }
+    }
+
+    /**
+     * Copies the pivots of a node's childs into the node's pivot block.
+     */
+    void buildPivotBlock(NodePtr node, PooledAllocator& pool)
+    {
+        size_t count = node->childs.size();
+        node->pivots = pool.allocateAligned<ElementType>(count*veclen_, PIVOT_BLOCK_ALIGNMENT);
+        for (size_t i=0; i<count; ++i) {
+            const ElementType* pivot = node->childs[i]->pivot;
+            if (SoaBlock::available) {
+                for (size_t j=0; j<veclen_; ++j) {
+                    node->pivots[j*count+i] = pivot[j];
+                }
+            }
+            else {
+                std::copy(pivot, pivot+veclen_, node->pivots+i*veclen_);
+            }
+        }
+    }
+
+    /**
+     * Computes the distances from a vector (a point or a query) to the pivots
+     * of a node's childs.
+     */
+    template <typename T>
+    void pivotDistances(NodePtr node, const T* vec, DistanceType* dists) const
+    {
+        if (SoaBlock::available) {
+            SoaBlock::apply(distance_, vec, node->pivots, node->childs.size(), node->childs.size(), dists);
+        }
+        else {
+            distance_block(distance_, vec, node->pivots, node->childs.size(), veclen_, dists);
+        }
+    }
+
 
 
-    void computeLabels(int* indices, int indices_length,  int* centers, int centers_length, int* labels, DistanceType& cost)
+    /**
+     * Assigns every point to its closest center (the first one on ties). Large
+     * clusters are labeled in chunks that run as parallel tasks.
+     *
+     * Params:
+     *     labels = output, index in centers of the center of every point
+     *     cost = output, sum of the distances of the points to their centers
+     *     context = holds the scratch buffers
+     */
+    void computeLabels(int* indices, int indices_length,  int* centers, int centers_length, int* labels, DistanceType& cost,
+                       BuildContext& context)
     {
+        if (context.center_points.size()<size_t(centers_length)) context.center_points.resize(centers_length);
+        const ElementType** center_points = &context.center_points[0];
+        for (int j=0; j<centers_length; ++j) {
+            center_points[j] = points_[centers[j]];
+        }
+        CenterSet center_set;
+        center_set.points = center_points;
+        center_set.block = NULL;
+        center_set.norms = NULL;
+        center_set.origin = NULL;
+        center_set.max_norm = 0;
+        center_set.count = centers_length;
+        size_t stride = dot_block_stride(centers_length);
+        if (Expansion::available) {
+            if (context.center_block.size()<veclen_*stride) context.center_block.resize(veclen_*stride);
+            if (context.center_norms.size()<size_t(centers_length)) context.center_norms.resize(centers_length);
+            const ElementType* const* expanded = center_points;
+            if (Expansion::translation_invariant) {
+                // far from the origin, the expansion cancels most of its digits:
+                // the vectors are expanded relative to the first center instead
+                size_t size = centers_length*veclen_;
+                if (context.shifted_centers.size()<size) context.shifted_centers.resize(size);
+                if (context.shifted_center_points.size()<size_t(centers_length)) {
+                    context.shifted_center_points.resize(centers_length);
+                }
+                center_set.origin = center_points[0];
+                for (int j=0; j<centers_length; ++j) {
+                    ElementType* shifted = &context.shifted_centers[j*veclen_];
+                    DistanceType norm = Expansion::shift(center_points[j], center_set.origin, veclen_, shifted);
+                    center_set.max_norm = std::max(center_set.max_norm, norm);
+                    context.shifted_center_points[j] = shifted;
+                }
+                expanded = &context.shifted_center_points[0];
+            }
+            Expansion::prepare(expanded, centers_length, veclen_, &context.center_block[0], &context.center_norms[0]);
+            center_set.block = &context.center_block[0];
+            center_set.norms = &context.center_norms[0];
+        }
+
+        // the tasks only get pointers, the buffers are allocated here so that
+        // running out of memory throws in the calling thread
+        int chunks = (indices_length+LABELS_CHUNK_POINTS-1)/LABELS_CHUNK_POINTS;
+        size_t block_size = LABELS_BLOCK_POINTS*stride;
+        size_t shifted_size = Expansion::translation_invariant ? LABELS_BLOCK_POINTS*veclen_ : 0;
+        if (context.chunk_costs.size()<size_t(chunks)) context.chunk_costs.resize(chunks);
+        if (context.dists.size()<chunks*block_size) context.dists.resize(chunks*block_size);
+        if (context.shifted_points.size()<chunks*shifted_size) context.shifted_points.resize(chunks*shifted_size);
+        DistanceType* chunk_costs = &context.chunk_costs[0];
+        DistanceType* dists = &context.dists[0];
+        ElementType* shifted_points = shifted_size>0 ? &context.shifted_points[0] : NULL;
+        for (int c=0; c<chunks; ++c)
+        {
+            int begin = c*LABELS_CHUNK_POINTS;
+            int length = std::min(LABELS_CHUNK_POINTS, indices_length-begin);
+            int* chunk_indices = indices+begin;
+            int* chunk_labels = labels+begin;
+            DistanceType* chunk_dists = dists+c*block_size;
+            ElementType* chunk_shifted = shifted_points+c*shifted_size;
+            DistanceType* chunk_cost = chunk_costs+c;
+#ifdef FLANN_OMP_TASKS
+#pragma omp task if(chunks>1) firstprivate(chunk_indices, length, center_set, chunk_labels, chunk_dists, chunk_shifted, chunk_cost)
+#endif
+            labelPoints(chunk_indices, length, center_set, chunk_labels, chunk_dists, chunk_shifted, chunk_cost);
+        }
+#ifdef FLANN_OMP_TASKS
+#pragma omp taskwait
+#endif
+
+        // summed in chunk order, the cost does not depend on the threads
         cost = 0;
-        for (int i=0; i<indices_length; ++i) 
+        for (int c=0; c<chunks; ++c) {
+            cost += chunk_costs[c];
+        }
+    }
+
+    /**
+     * Labels a chunk of points, LABELS_BLOCK_POINTS at a time.
+     *
+     * Params:
+     *     dists = scratch space for LABELS_BLOCK_POINTS*dot_block_stride(centers.count) distances
+     *     shifted = scratch space for LABELS_BLOCK_POINTS vectors, when the expansion is translation invariant
+     *     cost = output, sum of the distances of the points to their centers
+     */
+    void labelPoints(const int* indices, int indices_length, const CenterSet& centers, int* labels, DistanceType* dists,
+                     ElementType* shifted, DistanceType* cost)
+    {
+        size_t stride = dot_block_stride(centers.count);
+        // the search prunes with the half gap between pivots, which needs every
+        // point to be closer to its own pivot by the distance itself
+        bool exact = Expansion::available && Metric::is_metric_for(distance_);
+        const ElementType* block[LABELS_BLOCK_POINTS];
+        const ElementType* expanded[LABELS_BLOCK_POINTS];
+        DistanceType norms[LABELS_BLOCK_POINTS];
+        DistanceType sum = 0;
+        for (int begin=0; begin<indices_length; begin+=LABELS_BLOCK_POINTS)
         {
-            ElementType* point = points_[indices[i]];
-            DistanceType dist = distance_(point, points_[centers[0]], veclen_);
-            labels[i] = 0;
-            for (int j=1; j<centers_length; ++j) 
+            int count = std::min(LABELS_BLOCK_POINTS, indices_length-begin);
+            for (int i=0; i<count; ++i) {
+                block[i] = points_[indices[begin+i]];
+                expanded[i] = block[i];
+                if (Expansion::translation_invariant) {
+                    expanded[i] = shifted+i*veclen_;
+                    norms[i] = Expansion::shift(block[i], centers.origin, veclen_, shifted+i*veclen_);
+                }
+            }
+            if (Expansion::available) {
+                Expansion::apply(expanded, count, centers.block, centers.norms, centers.count, veclen_, dists);
+            }
+            else {
+                for (int i=0; i<count; ++i) {
+                    for (int j=0; j<centers.count; ++j) {
+                        dists[i*stride+j] = distance_(block[i], centers.points[j], veclen_);
+                    }
+                }
+            }
+            for (int i=0; i<count; ++i)
             {
-                DistanceType new_dist = distance_(point, points_[centers[j]], veclen_);
-                if (dist>new_dist) 
-                {
-                    labels[i] = j;
-                    dist = new_dist;
+                const DistanceType* point_dists = dists+i*stride;
+                int label = 0;
+                for (int j=1; j<centers.count; ++j) {
+                    if (point_dists[label]>point_dists[j]) label = j;
+                }
+                if (!Expansion::available) {
+                    labels[begin+i] = label;
+                    sum += point_dists[label];
+                    continue;
                 }
+                DistanceType dist = distance_(block[i], centers.points[label], veclen_);
+                if (exact) {
+                    // the rounding of the expansion may rank two near centers the
+                    // wrong way: every center within twice its error bound of the
+                    // best one is compared with the distance itself
+                    DistanceType window = std::numeric_limits<DistanceType>::max();
+                    if (Expansion::translation_invariant) {
+                        window = 2*Expansion::error_bound(norms[i], centers.max_norm, veclen_);
+                    }
+                    DistanceType limit = point_dists[label]+window;
+                    int best = label;
+                    for (int j=0; j<centers.count; ++j) {
+                        if (j==best || !(point_dists[j]<=limit)) continue;
+                        DistanceType center_dist = distance_(block[i], centers.points[j], veclen_);
+                        if (center_dist<dist || (center_dist==dist && j<label)) {
+                            label = j;
+                            dist = center_dist;
+                        }
+                    }
+                }
+                labels[begin+i] = label;
+                sum += dist;
             }
-            cost += dist;
         }
+        *cost = sum;
+    }
+
+    /**
+     * Computes the covering radius (in metric space) of a cluster.
+     *
+     * Params:
+     *     pivot = index of the cluster center
+     *     indices = indices of the points belonging to the cluster
+     */
+    DistanceType coveringRadius(int pivot, const int* indices, int indices_length)
+    {
+        DistanceType radius = 0;
+        if (!Metric::is_metric_for(distance_)) return radius;
+        for (int i=0; i<indices_length; ++i) {
+            DistanceType dist = distance_(points_[indices[i]], points_[pivot], veclen_);
+            if (radius<dist) radius = dist;
+        }
+        return Metric::to_metric(distance_, radius);
+    }
+
+    /**
+     * Builds the i-th tree.
+     */
+    void buildTree(int i, unsigned int seed, bool* failed)
+    {
+        std::vector<int> indices;
+        try {
+            indices.resize(size_);
+        }
+        catch (std::bad_alloc&) {
+#pragma omp critical(flann_build_failed)
+            *failed = true;
+            return;
+        }
+        for (size_t j=0; j<size_; ++j)
+        {
+            indices[j] = int(j);
+        }
+        computeClusteringTask(tree_roots_[i], &indices[0], int(size_), seed, failed);
+    }
+
+    /**
+     * Clusters the points of a node with a center chooser and a memory pool of
+     * its own, so that it can run concurrently with the rest of the build. The
+     * chooser's random numbers start from seed.
+     */
+    void computeClusteringTask(NodePtr node, int* indices, int indices_length, unsigned int seed, bool* failed)
+    {
+        // exceptions cannot leave a parallel region or a task, so everything the
+        // task allocates, the chooser included, is done in the try
+        CenterChooser<Distance>* chooser = NULL;
+        try {
+            chooser = createCenterChooser();
+            chooser->setDataSize(veclen_);
+            chooser->seed(seed);
+            BuildContext context(*chooser, threadBuildPool(), seed, failed);
+            computeClustering(node, indices, indices_length, context);
+        }
+        catch (std::bad_alloc&) {
+#ifdef FLANN_OMP_TASKS
+            // the exception skipped the taskwait of computeClustering(), and the
+            // tasks already started still use the indices and the chooser
+#pragma omp taskwait
+#endif
+#pragma omp critical(flann_build_failed)
+            *failed = true;
+        }
+        delete chooser;
+    }
+
+    /**
+     * Memory pool for the nodes created by the calling thread. The tasks are
+     * tied to the thread that starts them and only leave it at a taskwait, so
+     * the tasks of a thread never use its pool concurrently. Outside of
+     * buildIndexImpl() (addPoints() runs on one thread) the nodes go to the
+     * pools of an earlier build or to pool_.
+     */
+    PooledAllocator& threadBuildPool()
+    {
+        size_t thread = 0;
+#ifdef _OPENMP
+        thread = size_t(omp_get_thread_num());
+#endif
+        return thread<build_pools_.size() ? *build_pools_[thread] : pool_;
     }
 
     /**
@@ -457,10 +1166,10 @@ protected:
      * Params:
      *     node = the node to cluster
      *     indices = indices of the points belonging to the current node
-     *     branching = the branching factor to use in the clustering
+     *     context = center chooser and memory pool of the thread
      *
      */
-    void computeClustering(NodePtr node, int* indices, int indices_length)
+    void computeClustering(NodePtr node, int* indices, int indices_length, BuildContext& context)
     {
         if (indices_length < leaf_max_size_) { // leaf node
             node->points.resize(indices_length);
@@ -469,14 +1178,19 @@ protected:
             	node->points[i].point = points_[indices[i]];
             }
             node->childs.clear();
+            if (pack_leaves_) {
+                packLeafPoints(node);
+            }
             return;
         }
 
-        std::vector<int> centers(branching_);
-        std::vector<int> labels(indices_length);
+        if (context.centers.size()<size_t(branching_)) context.centers.resize(branching_);
+        if (context.labels.size()<size_t(indices_length)) context.labels.resize(indices_length);
+        int* centers = &context.centers[0];
+        int* labels = &context.labels[0];
 
         int centers_length;
-        (*chooseCenters_)(branching_, indices, indices_length, &centers[0], centers_length);
+        context.chooseCenters(branching_, indices, indices_length, centers, centers_length);
 
         if (centers_length<branching_) 
         {
@@ -487,60 +1201,152 @@ protected:
             	node->points[i].point = points_[indices[i]];
             }
             node->childs.clear();
+            if (pack_leaves_) {
+                packLeafPoints(node);
+            }
             return;
         }
 
 
         //  assign points to clusters
         DistanceType cost;
-        computeLabels(indices, indices_length, &centers[0], centers_length, &labels[0], cost);
+        computeLabels(indices, indices_length, centers, centers_length, labels, cost, context);
+
+        // a leaf being split keeps its points only in the childs
+        free_aligned(node->point_data);
+        node->point_data = NULL;
+        node->point_data_capacity = 0;
+
+        // counting sort of the indices by label: child_start[i] first counts
+        // the points before cluster i, then serves as the scatter position
+        // and ends at the start of cluster i+1
+        size_t child_starts_base = context.child_starts.size();
+        context.child_starts.resize(child_starts_base+branching_+1, 0);
+        int* child_start = &context.child_starts[child_starts_base];
+        for (int j=0; j<indices_length; ++j) {
+            ++child_start[labels[j]+1];
+        }
+        for (int i=0; i<branching_; ++i) {
+            child_start[i+1] += child_start[i];
+        }
+        if (context.partition.size()<size_t(indices_length)) context.partition.resize(indices_length);
+        int* partition = &context.partition[0];
+        for (int j=0; j<indices_length; ++j) {
+            partition[child_start[labels[j]]++] = indices[j];
+        }
+        std::copy(partition, partition+indices_length, indices);
+        for (int i=branching_; i>0; --i) {
+            child_start[i] = child_start[i-1];
+        }
+        child_start[0] = 0;
 
         node->childs.resize(branching_);
-        int start = 0;
-        int end = start;
         for (int i=0; i<branching_; ++i)
         {
-            for (int j=0; j<indices_length; ++j)
-            {
-                if (labels[j]==i) 
-                {
-                    std::swap(indices[j],indices[end]);
-                    std::swap(labels[j],labels[end]);
-                    end++;
-                }
-            }
-
-            node->childs[i] = new(pool_) Node();
+            node->childs[i] = new(context.pool) Node();
             node->childs[i]->pivot_index = centers[i];
             node->childs[i]->pivot = points_[centers[i]];
+            node->childs[i]->radius = coveringRadius(centers[i], indices+child_start[i], child_start[i+1]-child_start[i]);
             node->childs[i]->points.clear();
-            computeClustering(node->childs[i],indices+start, end-start);
-            start=end;
         }
+        buildPivotBlock(node, context.pool);
+
+        for (int i=0; i<branching_; ++i)
+        {
+            // the recursion may have moved the stack of the cluster bounds
+            child_start = &context.child_starts[child_starts_base];
+            NodePtr child = node->childs[i];
+            int* child_indices = indices+child_start[i];
+            int child_length = child_start[i+1]-child_start[i];
+            if (child_length>=CLUSTERING_TASK_MIN_POINTS) {
+                // the large clusters get seeds of their own, whether they run in
+                // another thread or not, so the tree does not depend on the threads
+                unsigned int seed = (unsigned int)context.random.rand_int();
+                bool* failed = context.failed;
+#ifdef FLANN_OMP_TASKS
+#pragma omp task firstprivate(child, child_indices, child_length, seed, failed)
+#endif
+                computeClusteringTask(child, child_indices, child_length, seed, failed);
+            }
+            else {
+                computeClustering(child, child_indices, child_length, context);
+            }
+        }
+        context.child_starts.resize(child_starts_base);
+#ifdef FLANN_OMP_TASKS
+        // the indices of the clusters belong to the caller once this returns
+#pragma omp taskwait
+#endif
     }
 
 
-    template<bool with_removed>
-    void findNeighborsWithRemoved(ResultSet<DistanceType>& result, const ElementType* vec, const SearchParams& searchParams) const
+    /**
+     * Number of points a search with the given parameters is expected to check:
+     * the checks budget plus what the first descent in each tree may overshoot.
+     */
+    size_t expectedChecks(const SearchParams& searchParams) const
     {
-        int maxChecks = searchParams.checks;
+        if (searchParams.checks<0) {
+            return size_;
+        }
+        return size_t(searchParams.checks) + size_t(trees_)*leaf_max_size_;
+    }
+
+    /**
+     * Number of branches worth keeping in the priority queue once the result is
+     * full: the search then stops after the checks budget, and a branch usually
+     * checks at least one point, so the farthest branches beyond that are not
+     * worth keeping. While the result is not full no branch is dropped (a
+     * branch may hold only removed or already checked points): the queue grows
+     * past this size, the first branch queued once the result is full drops the
+     * farthest ones to bring it back, and the next query starts again from this
+     * size. Without a checks limit no branch may be dropped either, for the
+     * search to stay exact, and the queue is unbounded (0).
+     */
+    size_t maxBranches(const SearchParams& searchParams) const
+    {
+        if (searchParams.checks<0) {
+            return 0;
+        }
+        return std::max(searchParams.checks, 1);
+    }
 
-        // Priority queue storing intermediate branches in the best-bin-first search
-        Heap<BranchSt>* heap = new Heap<BranchSt>(size_);
+    template<bool with_removed>
+    void findNeighborsWithRemoved(ResultSet<DistanceType>& result, const QueryElementType* vec, const SearchParams& searchParams,
+                                  SearchContext& context) const
+    {
+        // without a checks limit the search only ends when all the branches have been
+        // explored or pruned, which makes it exact for metric distances
+        int maxChecks = searchParams.checks<0 ? std::numeric_limits<int>::max() : searchParams.checks;
+        // with eps>0 the neighbors found are within a factor (1+eps) of the true ones
+        // (a checks limit still applies on top of that)
+        context.bound_scale = 1+std::max(searchParams.eps, 0.0f);
+
+        // the time budget is only checked between the branches popped after the first
+        // descent in every tree, so a query always returns some neighbors
+        bool timed = searchParams.max_time_us>=0;
+        double deadline = timed ? monotonic_time_us()+searchParams.max_time_us : 0;
+        int pops = 0;
+        result.setTruncated(false);
 
-        DynamicBitset checked(size_);
         int checks = 0;
         for (int i=0; i<trees_; ++i) {
-            findNN<with_removed>(tree_roots_[i], result, vec, checks, maxChecks, heap, checked);
+            findNN<with_removed>(tree_roots_[i], result, vec, checks, maxChecks, 0, context);
         }
 
         BranchSt branch;
-        while (heap->popMin(branch) && (checks<maxChecks || !result.full())) {
+        while (context.heap.popMin(branch) && (checks<maxChecks || !result.full())) {
+            if (timed && ++pops%DEADLINE_CHECK_INTERVAL==0 && monotonic_time_us()>deadline) {
+                result.setTruncated(true);
+                break;
+            }
+            // the result may have improved since the branch was queued
+            if (Metric::is_metric_for(distance_) && branch.bound*context.bound_scale>Metric::to_metric(distance_, result.worstDist())) {
+                continue;
+            }
             NodePtr node = branch.node;
-            findNN<with_removed>(node, result, vec, checks, maxChecks, heap, checked);
+            findNN<with_removed>(node, result, vec, checks, maxChecks, branch.bound, context);
         }
-
-        delete heap;
     }
 
 
@@ -554,49 +1360,102 @@ protected:
      *      vec = query points
      *      checks = how many points in the dataset have been checked so far
      *      maxChecks = maximum dataset points to checks
+     *      bound = lower bound (in metric space) on the distance to the points under node
+     *      context = search scratch state (branch queue and checked points)
      */
 
     template<bool with_removed>
-    void findNN(NodePtr node, ResultSet<DistanceType>& result, const ElementType* vec, int& checks, int maxChecks,
-                Heap<BranchSt>* heap,  DynamicBitset& checked) const
+    void findNN(NodePtr node, ResultSet<DistanceType>& result, const QueryElementType* vec, int& checks, int maxChecks,
+                DistanceType bound, SearchContext& context) const
     {
+        // once the budget is spent nothing below this node would be checked, and
+        // no branch queued from here would be popped
+        if (checks>=maxChecks)
+        {
+            if (result.full()) 
+                return;
+        }
+
         if (node->childs.empty()) 
         {
-            if (checks>=maxChecks)
-            {
-                if (result.full()) 
-                    return;
+            // with packed leaves the vectors are scanned sequentially from the leaf storage
+            const ElementType* point_data = node->point_data;
+            const DistanceType* leaf_distances = NULL;
+            if (SoaBlock::available && point_data != NULL && !node->points.empty()) {
+                // stored by coordinate: the distances to the whole leaf in one pass
+                if (context.leaf_distances.size()<node->points.size()) {
+                    context.leaf_distances.resize(node->points.size());
+                }
+                SoaBlock::apply(distance_, vec, point_data, node->points.size(), node->point_data_capacity,
+                                 &context.leaf_distances[0]);
+                leaf_distances = &context.leaf_distances[0];
             }
-
             for (size_t i=0; i<node->points.size(); ++i) {
             	PointInfo& pointInfo = node->points[i];
             	if (with_removed) {
             		if (removed_points_.test(pointInfo.index)) continue;
             	}
-                if (checked.test(pointInfo.index)) continue;
-                DistanceType dist = distance_(pointInfo.point, vec, veclen_);
+                if (!context.checked.insert(pointInfo.index)) continue;
+                DistanceType dist;
+                if (leaf_distances != NULL) {
+                    dist = leaf_distances[i];
+                }
+                else {
+                    const ElementType* point = point_data ? point_data+i*veclen_ : pointInfo.point;
+                    // candidates farther than the current worst result are abandoned part way
+                    dist = distance_(point, vec, veclen_, result.worstDist());
+                }
                 result.addPoint(dist, pointInfo.index);
-                checked.set(pointInfo.index);
                 ++checks;
             }
         }
         else {
-            DistanceType* domain_distances = new DistanceType[branching_];
+            DistanceType* domain_distances = &context.domain_distances[0];
+            pivotDistances(node, vec, domain_distances);
             int best_index = 0;
-            domain_distances[best_index] = distance_(vec, node->childs[best_index]->pivot, veclen_);
             for (int i=1; i<branching_; ++i) {
-                domain_distances[i] = distance_(vec, node->childs[i]->pivot, veclen_);
                 if (domain_distances[i]<domain_distances[best_index]) {
                     best_index = i;
                 }
             }
+            DistanceType best_metric = 0;
+            DistanceType worst_metric = 0;
+            if (Metric::is_metric_for(distance_)) {
+                best_metric = Metric::to_metric(distance_, domain_distances[best_index]);
+                worst_metric = Metric::to_metric(distance_, result.worstDist());
+            }
+            DistanceType best_bound = bound;
+            bool best_pruned = false;
             for (int i=0; i<branching_; ++i) {
-                if (i!=best_index) {
-                    heap->insert(BranchSt(node->childs[i],domain_distances[i]));
+                DistanceType child_bound = bound;
+                if (Metric::is_metric_for(distance_)) {
+                    // by the triangle inequality the points of a child are at least d(q,pivot)-radius
+                    // away, and as they are closer to their pivot than to the best pivot, at least
+                    // half the pivot distance gap away
+                    DistanceType pivot_dist = Metric::to_metric(distance_, domain_distances[i]);
+                    DistanceType radius = node->childs[i]->radius;
+                    if (pivot_dist>radius && child_bound<pivot_dist-radius) child_bound = pivot_dist-radius;
+                    DistanceType half_gap = (pivot_dist-best_metric)/2;
+                    if (child_bound<half_gap) child_bound = half_gap;
+                    if (child_bound*context.bound_scale>worst_metric) {
+                        best_pruned = best_pruned || i==best_index;
+                        continue;
+                    }
+                }
+                if (i==best_index) {
+                    best_bound = child_bound;
+                }
+                else if (result.full()) {
+                    context.heap.insert(BranchSt(node->childs[i],domain_distances[i],child_bound));
+                }
+                else {
+                    // the search goes on past the checks budget until the result is full
+                    context.heap.push(BranchSt(node->childs[i],domain_distances[i],child_bound));
                 }
             }
-            delete[] domain_distances;
-            findNN<with_removed>(node->childs[best_index],result,vec, checks, maxChecks, heap, checked);
+            if (!best_pruned) {
+                findNN<with_removed>(node->childs[best_index],result,vec, checks, maxChecks, best_bound, context);
+            }
         }
     }
     
@@ -610,6 +1469,9 @@ protected:
         	pointInfo.point = point;
         	pointInfo.index = index;
             node->points.push_back(pointInfo);
+            if (pack_leaves_) {
+                appendLeafPoint(node);
+            }
 
             if (node->points.size()>=size_t(branching_)) 
             {
@@ -619,25 +1481,20 @@ protected:
                 {
                 	indices[i] = node->points[i].index;
                 }
-                computeClustering(node, &indices[0], indices.size());
+                bool failed = false;
+                BuildContext context(*chooseCenters_, pool_, (unsigned int)rand_int(), &failed);
+                computeClustering(node, &indices[0], int(indices.size()), context);
             }
         }
         else
         {            
             // find the closest child
-            int closest = 0;
-            ElementType* center = node->childs[closest]->pivot;
-            DistanceType dist = distance_(center, point, veclen_);
-
-            for (size_t i=1;i<size_t(branching_);++i) 
-            {
-                center = node->childs[i]->pivot;
-                DistanceType crt_dist = distance_(center, point, veclen_);
-                if (crt_dist<dist)
-                {
-                    dist = crt_dist;
-                    closest = i;
-                }
+            std::vector<DistanceType> dists(branching_);
+            pivotDistances(node, point, &dists[0]);
+            int closest = int(std::min_element(dists.begin(), dists.end()) - dists.begin());
+            if (Metric::is_metric_for(distance_)) {
+                DistanceType dist = Metric::to_metric(distance_, dists[closest]);
+                if (node->childs[closest]->radius<dist) node->childs[closest]->radius = dist;
             }
             addPointToTree(node->childs[closest], index);
         }                
@@ -655,6 +1512,12 @@ protected:
     	std::swap(trees_, other.trees_);
     	std::swap(centers_init_, other.centers_init_);
     	std::swap(leaf_max_size_, other.leaf_max_size_);
+    	std::swap(pack_leaves_, other.pack_leaves_);
+    	std::swap(pretransform_, other.pretransform_);
+    	std::swap(pretransformed_data_, other.pretransformed_data_);
+    	std::swap(cores_, other.cores_);
+    	std::swap(centers_sample_, other.centers_sample_);
+    	std::swap(build_pools_, other.build_pools_);
     	std::swap(chooseCenters_, other.chooseCenters_);
     }
 
@@ -701,6 +1564,39 @@ protected:
      * Max size of leaf nodes
      */
     int leaf_max_size_;
+
+    /**
+     * Whether leaves keep their own contiguous copy of their points' vectors
+     */
+    bool pack_leaves_;
+
+    /**
+     * Whether the points are stored transformed by the distance's pretransform.
+     * getPoint() then returns the transformed point, and a saved index needs
+     * "save_dataset" as the original points are not kept.
+     */
+    bool pretransform_;
+
+    /**
+     * Storage of the transformed points, one block per addPoints() call
+     */
+    std::vector<ElementType*> pretransformed_data_;
+
+    /**
+     * Number of threads building the index, 0 for all the available ones
+     */
+    int cores_;
+
+    /**
+     * Points per center the center chooser samples from large nodes, 0 for all
+     */
+    int centers_sample_;
+
+    /**
+     * Memory pools of the nodes created by buildIndex(), one per build thread,
+     * as the trees are built concurrently (pool_ holds the nodes created otherwise)
+     */
+    std::vector<PooledAllocator*> build_pools_;
     
     /**
      * Algorithm used to choose initial centers
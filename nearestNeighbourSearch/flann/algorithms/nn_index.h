@@ -33,7 +33,9 @@
 
 #include <vector>
 #include <queue>
+#include <mutex>
 #include <unordered_map>
+#include <utility>
 
 #include "../general.h"
 #include "../util/matrix.h"
@@ -48,6 +50,102 @@ namespace flann
 #define KNN_HEAP_THRESHOLD 250
 
 
+/**
+ * Per-thread scratch state used while answering queries (branch queue, visited
+ * set, temporary buffers). An index that needs one derives from this class; the
+ * search loops take one context per worker thread from the index's pool and
+ * reuse it for every query that thread handles.
+ */
+class SearchContextBase
+{
+public:
+    virtual ~SearchContextBase() {};
+};
+
+/**
+ * Search contexts kept by an index between searches, so that the threads
+ * searching it (OpenMP workers or the caller's own threads) reuse their
+ * scratch state across calls instead of allocating it for every call. It
+ * holds at most one context per thread that searched the index concurrently.
+ */
+class SearchContextPool
+{
+public:
+    SearchContextPool() {}
+
+    /**
+     * A copy of an index starts with no cached contexts
+     */
+    SearchContextPool(const SearchContextPool&) {}
+
+    SearchContextPool& operator=(const SearchContextPool&)
+    {
+        return *this;
+    }
+
+    ~SearchContextPool()
+    {
+        clear();
+    }
+
+    /**
+     * @return a cached context (now owned by the caller) or NULL if there is none
+     */
+    SearchContextBase* pop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (contexts_.empty()) return NULL;
+        SearchContextBase* context = contexts_.back();
+        contexts_.pop_back();
+        return context;
+    }
+
+    /**
+     * Gives a context back to the pool.
+     */
+    void push(SearchContextBase* context)
+    {
+        if (context==NULL) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        try {
+            contexts_.push_back(context);
+        }
+        catch (std::bad_alloc&) {
+            delete context;
+        }
+    }
+
+    /**
+     * Deletes the cached contexts.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i=0; i<contexts_.size(); ++i) {
+            delete contexts_[i];
+        }
+        contexts_.clear();
+    }
+
+    /**
+     * Exchanges the cached contexts with the ones of another pool, which
+     * follow the indices they were created for when the indices are swapped.
+     */
+    void swap(SearchContextPool& other)
+    {
+        if (&other==this) return;
+        std::lock(mutex_, other.mutex_);
+        std::lock_guard<std::mutex> lock(mutex_, std::adopt_lock);
+        std::lock_guard<std::mutex> other_lock(other.mutex_, std::adopt_lock);
+        contexts_.swap(other.contexts_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<SearchContextBase*> contexts_;
+};
+
+
 class IndexBase
 {
 public:
@@ -68,6 +166,45 @@ public:
     virtual void saveIndex(FILE* stream) = 0;
 };
 
+/**
+ * Rows of a query matrix of T as findNeighbors() takes them, vectors of Query
+ * (see query_element): a row of another type is widened in a buffer.
+ */
+template <typename T, typename Query>
+class QueryRows
+{
+public:
+    explicit QueryRows(const Matrix<T>& queries) : queries_(queries), row_(queries.cols) {}
+
+    const Query* operator[](size_t index)
+    {
+        const T* row = queries_[index];
+        for (size_t i=0; i<row_.size(); ++i) {
+            row_[i] = Query(row[i]);
+        }
+        return row_.empty() ? NULL : &row_[0];
+    }
+
+private:
+    const Matrix<T>& queries_;
+    std::vector<Query> row_;
+};
+
+template <typename T>
+class QueryRows<T, T>
+{
+public:
+    explicit QueryRows(const Matrix<T>& queries) : queries_(queries) {}
+
+    const T* operator[](size_t index) const
+    {
+        return queries_[index];
+    }
+
+private:
+    const Matrix<T>& queries_;
+};
+
 /**
  * Nearest-neighbour index base class
  */
@@ -77,6 +214,8 @@ class NNIndex : public IndexBase
 public:
     typedef typename Distance::ElementType ElementType;
     typedef typename Distance::ResultType DistanceType;
+    // type of the queries findNeighbors() takes, see query_element
+    typedef typename query_element<ElementType>::type QueryElementType;
 
 	NNIndex(Distance d) : distance_(d), last_id_(0), size_(0), size_at_build_(0), veclen_(0),
 			removed_(false), removed_count_(0), data_ptr_(NULL)
@@ -233,6 +372,7 @@ public:
                         strlen(FLANN_SIGNATURE_)) != 0) {
     	        throw FLANNException("Invalid index file, wrong signature");
     	    }
+            check_header_version(header);
 
             if (header.h.data_type != flann_datatype_value<ElementType>::value) {
                 throw FLANNException("Datatype of saved index is different than of the one to be created.");
@@ -292,12 +432,277 @@ public:
      * @param[out] dists Distances to the nearest neighbors found
      * @param[in] knn Number of nearest neighbors to return
      * @param[in] params Search parameters
+     * @param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
      */
     virtual int knnSearch(const Matrix<ElementType>& queries,
     		Matrix<size_t>& indices,
     		Matrix<DistanceType>& dists,
     		size_t knn,
-    		const SearchParams& params) const
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return knnSearchRows(queries, indices, dists, knn, params, truncated);
+    }
+
+    /**
+     *
+     * @param queries
+     * @param indices
+     * @param dists
+     * @param knn
+     * @param params
+     * @param truncated
+     * @return
+     */
+    int knnSearch(const Matrix<ElementType>& queries,
+                                 Matrix<int>& indices,
+                                 Matrix<DistanceType>& dists,
+                                 size_t knn,
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return knnSearchRows(queries, indices, dists, knn, params, truncated);
+    }
+
+
+    /**
+     * @brief Perform k-nearest neighbor search
+     * @param[in] queries The query points for which to find the nearest neighbors
+     * @param[out] indices The indices of the nearest neighbors found
+     * @param[out] dists Distances to the nearest neighbors found
+     * @param[in] knn Number of nearest neighbors to return
+     * @param[in] params Search parameters
+     * @param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
+     */
+    int knnSearch(const Matrix<ElementType>& queries,
+					std::vector< std::vector<size_t> >& indices,
+					std::vector<std::vector<DistanceType> >& dists,
+    				size_t knn,
+    				const SearchParams& params,
+    				std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return knnSearchRows(queries, indices, dists, knn, params, truncated);
+    }
+
+
+    /**
+     *
+     * @param queries
+     * @param indices
+     * @param dists
+     * @param knn
+     * @param params
+     * @param truncated
+     * @return
+     */
+    int knnSearch(const Matrix<ElementType>& queries,
+                                 std::vector< std::vector<int> >& indices,
+                                 std::vector<std::vector<DistanceType> >& dists,
+                                 size_t knn,
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return knnSearchRows(queries, indices, dists, knn, params, truncated);
+    }
+
+    /**
+     * @brief Perform radius search
+     * @param[in] query The query point
+     * @param[out] indices The indices of the neighbors found within the given radius
+     * @param[out] dists The distances to the nearest neighbors found
+     * @param[in] radius The radius used for search
+     * @param[in] params Search parameters
+     * @param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
+     * @return Number of neighbors found
+     */
+    int radiusSearch(const Matrix<ElementType>& queries,
+    		Matrix<size_t>& indices,
+    		Matrix<DistanceType>& dists,
+    		float radius,
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return radiusSearchRows(queries, indices, dists, radius, params, truncated);
+    }
+
+
+    /**
+     *
+     * @param queries
+     * @param indices
+     * @param dists
+     * @param radius
+     * @param params
+     * @param truncated
+     * @return
+     */
+    int radiusSearch(const Matrix<ElementType>& queries,
+                                    Matrix<int>& indices,
+                                    Matrix<DistanceType>& dists,
+                                    float radius,
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return radiusSearchRows(queries, indices, dists, radius, params, truncated);
+    }
+
+    /**
+     * @brief Perform radius search
+     * @param[in] query The query point
+     * @param[out] indices The indices of the neighbors found within the given radius
+     * @param[out] dists The distances to the nearest neighbors found
+     * @param[in] radius The radius used for search
+     * @param[in] params Search parameters
+     * @param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
+     * @return Number of neighbors found
+     */
+    int radiusSearch(const Matrix<ElementType>& queries,
+    		std::vector< std::vector<size_t> >& indices,
+    		std::vector<std::vector<DistanceType> >& dists,
+    		float radius,
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return radiusSearchRows(queries, indices, dists, radius, params, truncated);
+    }
+
+    /**
+     *
+     * @param queries
+     * @param indices
+     * @param dists
+     * @param radius
+     * @param params
+     * @param truncated
+     * @return
+     */
+    int radiusSearch(const Matrix<ElementType>& queries,
+                                    std::vector< std::vector<int> >& indices,
+                                    std::vector<std::vector<DistanceType> >& dists,
+                                    float radius,
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return radiusSearchRows(queries, indices, dists, radius, params, truncated);
+    }
+
+    /**
+     * \brief Perform k-nearest neighbor search with queries of another type
+     * than the points (float queries in an index storing a 16 bit floating
+     * point format, see is_query_convertible). The queries are used as they
+     * are, the distances widen the points to their type.
+     */
+    template <typename QueryType, typename Indices, typename Dists>
+    typename enable_if<is_query_convertible<QueryType, ElementType>::value, int>::type
+    knnSearch(const Matrix<QueryType>& queries,
+                                 Indices& indices,
+                                 Dists& dists,
+                                 size_t knn,
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return knnSearchRows(queries, indices, dists, knn, params, truncated);
+    }
+
+    /**
+     * \brief Perform radius search with queries of another type than the
+     * points, see knnSearch() above.
+     */
+    template <typename QueryType, typename Indices, typename Dists>
+    typename enable_if<is_query_convertible<QueryType, ElementType>::value, int>::type
+    radiusSearch(const Matrix<QueryType>& queries,
+                                    Indices& indices,
+                                    Dists& dists,
+                                    float radius,
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return radiusSearchRows(queries, indices, dists, radius, params, truncated);
+    }
+
+
+    virtual void findNeighbors(ResultSet<DistanceType>& result, const QueryElementType* vec, const SearchParams& searchParams) const = 0;
+
+    /**
+     * Same as above, but reuses the scratch state in context (created by
+     * createSearchContext) instead of allocating it for this query.
+     */
+    virtual void findNeighbors(ResultSet<DistanceType>& result, const QueryElementType* vec, const SearchParams& searchParams,
+                               SearchContextBase* /*context*/) const
+    {
+        findNeighbors(result, vec, searchParams);
+    }
+
+    /**
+     * Creates the per-thread scratch state passed to findNeighbors().
+     * @return the new context (owned by the caller) or NULL if the index needs none
+     */
+    virtual SearchContextBase* createSearchContext(const SearchParams& /*searchParams*/) const
+    {
+        return NULL;
+    }
+
+    /**
+     * Checks if a context created by createSearchContext() earlier can serve
+     * a search with the given parameters in the index as it is now (the index
+     * may have grown since).
+     */
+    virtual bool searchContextFits(const SearchContextBase* /*context*/, const SearchParams& /*searchParams*/) const
+    {
+        return true;
+    }
+
+    /**
+     * Search context taken from the index's pool for the duration of a scope,
+     * one per searching thread.
+     */
+    class ScopedSearchContext
+    {
+    public:
+        ScopedSearchContext(const NNIndex& index, const SearchParams& searchParams) : index_(index), context_(NULL)
+        {
+            context_ = index_.search_contexts_.pop();
+            if (context_!=NULL && !index_.searchContextFits(context_, searchParams)) {
+                delete context_;
+                context_ = NULL;
+            }
+            if (context_==NULL) {
+                context_ = index_.createSearchContext(searchParams);
+            }
+        }
+
+        ~ScopedSearchContext()
+        {
+            index_.search_contexts_.push(context_);
+        }
+
+        SearchContextBase* get() const
+        {
+            return context_;
+        }
+
+    private:
+        ScopedSearchContext(const ScopedSearchContext&);
+        ScopedSearchContext& operator=(const ScopedSearchContext&);
+
+        const NNIndex& index_;
+        SearchContextBase* context_;
+    };
+
+protected:
+
+    /*
+     * Batch searches for queries of any type the index can search: the rows are
+     * handed to findNeighbors() through QueryRows.
+     */
+
+    template <typename QueryType>
+    int knnSearchRows(const Matrix<QueryType>& queries,
+    		Matrix<size_t>& indices,
+    		Matrix<DistanceType>& dists,
+    		size_t knn,
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated) const
     {
     	assert(queries.cols == veclen());
     	assert(indices.rows >= queries.rows);
@@ -313,16 +718,20 @@ public:
     		use_heap = (params.use_heap==FLANN_True)?true:false;
     	}
     	int count = 0;
+    	unsigned char* truncated_flags = truncatedFlags(truncated, queries.rows);
 
     	if (use_heap) {
 #pragma omp parallel num_threads(params.cores)
     		{
     			KNNResultSet2<DistanceType> resultSet(knn);
+    			ScopedSearchContext context(*this, params);
+    			QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     			for (int i = 0; i < (int)queries.rows; i++) 
                 {
     				resultSet.clear();
-    				findNeighbors(resultSet, queries[i], params);
+    				findNeighbors(resultSet, rows[i], params, context.get());
+    				if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     				size_t n = std::min(resultSet.size(), knn);
     				resultSet.copy(indices[i], dists[i], n, params.sorted);
     				indices_to_ids(indices[i], indices[i], n);
@@ -334,11 +743,14 @@ public:
 #pragma omp parallel num_threads(params.cores)
     		{
     			KNNSimpleResultSet<DistanceType> resultSet(knn);
+    			ScopedSearchContext context(*this, params);
+    			QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     			for (int i = 0; i < (int)queries.rows; i++) 
                 {
     				resultSet.clear();
-    				findNeighbors(resultSet, queries[i], params);
+    				findNeighbors(resultSet, rows[i], params, context.get());
+    				if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     				size_t n = std::min(resultSet.size(), knn);
     				resultSet.copy(indices[i], dists[i], n, params.sorted);
     				indices_to_ids(indices[i], indices[i], n);
@@ -349,23 +761,16 @@ public:
     	return count;
     }
 
-    /**
-     *
-     * @param queries
-     * @param indices
-     * @param dists
-     * @param knn
-     * @param params
-     * @return
-     */
-    int knnSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int knnSearchRows(const Matrix<QueryType>& queries,
                                  Matrix<int>& indices,
                                  Matrix<DistanceType>& dists,
                                  size_t knn,
-                           const SearchParams& params) const
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated) const
     {
     	flann::Matrix<size_t> indices_(new size_t[indices.rows*indices.cols], indices.rows, indices.cols);
-    	int result = knnSearch(queries, indices_, dists, knn, params);
+    	int result = knnSearchRows(queries, indices_, dists, knn, params, truncated);
 
     	for (size_t i=0;i<indices.rows;++i) {
     		for (size_t j=0;j<indices.cols;++j) {
@@ -376,20 +781,13 @@ public:
     	return result;
     }
 
-
-    /**
-     * @brief Perform k-nearest neighbor search
-     * @param[in] queries The query points for which to find the nearest neighbors
-     * @param[out] indices The indices of the nearest neighbors found
-     * @param[out] dists Distances to the nearest neighbors found
-     * @param[in] knn Number of nearest neighbors to return
-     * @param[in] params Search parameters
-     */
-    int knnSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int knnSearchRows(const Matrix<QueryType>& queries,
 					std::vector< std::vector<size_t> >& indices,
 					std::vector<std::vector<DistanceType> >& dists,
     				size_t knn,
-    				const SearchParams& params) const
+    				const SearchParams& params,
+    				std::vector<unsigned char>* truncated) const
     {
         assert(queries.cols == veclen());
         bool use_heap;
@@ -404,14 +802,18 @@ public:
 		if (dists.size() < queries.rows ) dists.resize(queries.rows);
 
 		int count = 0;
+		unsigned char* truncated_flags = truncatedFlags(truncated, queries.rows);
 		if (use_heap) {
 #pragma omp parallel num_threads(params.cores)
 			{
 				KNNResultSet2<DistanceType> resultSet(knn);
+				ScopedSearchContext context(*this, params);
+				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
 				for (int i = 0; i < (int)queries.rows; i++) {
 					resultSet.clear();
-					findNeighbors(resultSet, queries[i], params);
+					findNeighbors(resultSet, rows[i], params, context.get());
+					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
 					size_t n = std::min(resultSet.size(), knn);
 					indices[i].resize(n);
 					dists[i].resize(n);
@@ -427,10 +829,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
 			{
 				KNNSimpleResultSet<DistanceType> resultSet(knn);
+				ScopedSearchContext context(*this, params);
+				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
 				for (int i = 0; i < (int)queries.rows; i++) {
 					resultSet.clear();
-					findNeighbors(resultSet, queries[i], params);
+					findNeighbors(resultSet, rows[i], params, context.get());
+					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
 					size_t n = std::min(resultSet.size(), knn);
 					indices[i].resize(n);
 					dists[i].resize(n);
@@ -446,24 +851,16 @@ public:
 		return count;
     }
 
-
-    /**
-     *
-     * @param queries
-     * @param indices
-     * @param dists
-     * @param knn
-     * @param params
-     * @return
-     */
-    int knnSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int knnSearchRows(const Matrix<QueryType>& queries,
                                  std::vector< std::vector<int> >& indices,
                                  std::vector<std::vector<DistanceType> >& dists,
                                  size_t knn,
-                           const SearchParams& params) const
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated) const
     {
     	std::vector<std::vector<size_t> > indices_;
-    	int result = knnSearch(queries, indices_, dists, knn, params);
+    	int result = knnSearchRows(queries, indices_, dists, knn, params, truncated);
 
     	indices.resize(indices_.size());
     	for (size_t i=0;i<indices_.size();++i) {
@@ -472,23 +869,17 @@ public:
     	return result;
     }
 
-    /**
-     * @brief Perform radius search
-     * @param[in] query The query point
-     * @param[out] indices The indices of the neighbors found within the given radius
-     * @param[out] dists The distances to the nearest neighbors found
-     * @param[in] radius The radius used for search
-     * @param[in] params Search parameters
-     * @return Number of neighbors found
-     */
-    int radiusSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int radiusSearchRows(const Matrix<QueryType>& queries,
     		Matrix<size_t>& indices,
     		Matrix<DistanceType>& dists,
     		float radius,
-    		const SearchParams& params) const
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated) const
     {
     	assert(queries.cols == veclen());
     	int count = 0;
+    	unsigned char* truncated_flags = truncatedFlags(truncated, queries.rows);
     	size_t num_neighbors = std::min(indices.cols, dists.cols);
     	int max_neighbors = params.max_neighbors;
     	if (max_neighbors<0) max_neighbors = num_neighbors;
@@ -498,10 +889,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
     		{
     			CountRadiusResultSet<DistanceType> resultSet(radius);
+    			ScopedSearchContext context(*this, params);
+    			QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     			for (int i = 0; i < (int)queries.rows; i++) {
     				resultSet.clear();
-    				findNeighbors(resultSet, queries[i], params);
+    				findNeighbors(resultSet, rows[i], params, context.get());
+    				if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     				count += resultSet.size();
     			}
     		}
@@ -513,10 +907,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
     			{
     				RadiusResultSet<DistanceType> resultSet(radius);
+    				ScopedSearchContext context(*this, params);
+    				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     				for (int i = 0; i < (int)queries.rows; i++) {
     					resultSet.clear();
-    					findNeighbors(resultSet, queries[i], params);
+    					findNeighbors(resultSet, rows[i], params, context.get());
+    					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     					size_t n = resultSet.size();
     					count += n;
     					if (n>num_neighbors) n = num_neighbors;
@@ -534,10 +931,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
     			{
     				KNNRadiusResultSet<DistanceType> resultSet(radius, max_neighbors);
+    				ScopedSearchContext context(*this, params);
+    				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     				for (int i = 0; i < (int)queries.rows; i++) {
     					resultSet.clear();
-    					findNeighbors(resultSet, queries[i], params);
+    					findNeighbors(resultSet, rows[i], params, context.get());
+    					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     					size_t n = resultSet.size();
     					count += n;
     					if ((int)n>max_neighbors) n = max_neighbors;
@@ -554,24 +954,16 @@ public:
         return count;
     }
 
-
-    /**
-     *
-     * @param queries
-     * @param indices
-     * @param dists
-     * @param radius
-     * @param params
-     * @return
-     */
-    int radiusSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int radiusSearchRows(const Matrix<QueryType>& queries,
                                     Matrix<int>& indices,
                                     Matrix<DistanceType>& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated) const
     {
     	flann::Matrix<size_t> indices_(new size_t[indices.rows*indices.cols], indices.rows, indices.cols);
-    	int result = radiusSearch(queries, indices_, dists, radius, params);
+    	int result = radiusSearchRows(queries, indices_, dists, radius, params, truncated);
 
     	for (size_t i=0;i<indices.rows;++i) {
     		for (size_t j=0;j<indices.cols;++j) {
@@ -582,32 +974,29 @@ public:
     	return result;
     }
 
-    /**
-     * @brief Perform radius search
-     * @param[in] query The query point
-     * @param[out] indices The indices of the neighbors found within the given radius
-     * @param[out] dists The distances to the nearest neighbors found
-     * @param[in] radius The radius used for search
-     * @param[in] params Search parameters
-     * @return Number of neighbors found
-     */
-    int radiusSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int radiusSearchRows(const Matrix<QueryType>& queries,
     		std::vector< std::vector<size_t> >& indices,
     		std::vector<std::vector<DistanceType> >& dists,
     		float radius,
-    		const SearchParams& params) const
+    		const SearchParams& params,
+    		std::vector<unsigned char>* truncated) const
     {
         assert(queries.cols == veclen());
     	int count = 0;
+    	unsigned char* truncated_flags = truncatedFlags(truncated, queries.rows);
     	// just count neighbors
     	if (params.max_neighbors==0) {
 #pragma omp parallel num_threads(params.cores)
     		{
     			CountRadiusResultSet<DistanceType> resultSet(radius);
+    			ScopedSearchContext context(*this, params);
+    			QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     			for (int i = 0; i < (int)queries.rows; i++) {
     				resultSet.clear();
-    				findNeighbors(resultSet, queries[i], params);
+    				findNeighbors(resultSet, rows[i], params, context.get());
+    				if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     				count += resultSet.size();
     			}
     		}
@@ -621,10 +1010,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
     			{
     				RadiusResultSet<DistanceType> resultSet(radius);
+    				ScopedSearchContext context(*this, params);
+    				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     				for (int i = 0; i < (int)queries.rows; i++) {
     					resultSet.clear();
-    					findNeighbors(resultSet, queries[i], params);
+    					findNeighbors(resultSet, rows[i], params, context.get());
+    					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     					size_t n = resultSet.size();
     					count += n;
     					indices[i].resize(n);
@@ -641,10 +1033,13 @@ public:
 #pragma omp parallel num_threads(params.cores)
     			{
     				KNNRadiusResultSet<DistanceType> resultSet(radius, params.max_neighbors);
+    				ScopedSearchContext context(*this, params);
+    				QueryRows<QueryType, QueryElementType> rows(queries);
 #pragma omp for schedule(static) reduction(+:count)
     				for (int i = 0; i < (int)queries.rows; i++) {
     					resultSet.clear();
-    					findNeighbors(resultSet, queries[i], params);
+    					findNeighbors(resultSet, rows[i], params, context.get());
+    					if (truncated_flags && resultSet.truncated()) truncated_flags[i] = 1;
     					size_t n = resultSet.size();
     					count += n;
     					if ((int)n>params.max_neighbors) n = params.max_neighbors;
@@ -661,23 +1056,16 @@ public:
     	return count;
     }
 
-    /**
-     *
-     * @param queries
-     * @param indices
-     * @param dists
-     * @param radius
-     * @param params
-     * @return
-     */
-    int radiusSearch(const Matrix<ElementType>& queries,
+    template <typename QueryType>
+    int radiusSearchRows(const Matrix<QueryType>& queries,
                                     std::vector< std::vector<int> >& indices,
                                     std::vector<std::vector<DistanceType> >& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated) const
     {
     	std::vector<std::vector<size_t> > indices_;
-    	int result = radiusSearch(queries, indices_, dists, radius, params);
+    	int result = radiusSearchRows(queries, indices_, dists, radius, params, truncated);
 
     	indices.resize(indices_.size());
     	for (size_t i=0;i<indices_.size();++i) {
@@ -686,11 +1074,6 @@ public:
     	return result;
     }
 
-
-    virtual void findNeighbors(ResultSet<DistanceType>& result, const ElementType* vec, const SearchParams& searchParams) const = 0;
-
-protected:
-
     virtual void freeIndex() = 0;
 
     virtual void buildIndexImpl() = 0;
@@ -709,6 +1092,18 @@ protected:
     }
 
 
+    /**
+     * Sizes the per-query truncation flags requested by a batch search.
+     *
+     * @return the cleared flags, or NULL if they were not requested
+     */
+    static unsigned char* truncatedFlags(std::vector<unsigned char>* flags, size_t queries)
+    {
+    	if (flags==NULL) return NULL;
+    	flags->assign(queries, 0);
+    	return queries>0 ? &(*flags)[0] : NULL;
+    }
+
     void indices_to_ids(const size_t* in, size_t* out, size_t size) const
     {
 		if (removed_)
@@ -766,7 +1161,7 @@ protected:
         {
     		points_[i] = new_points[i-size_];
             ids_[i] = next_id();
-            id2index.insert(make_pair(ids_[i], i));
+            id2index.insert(std::make_pair(ids_[i], i));
             vec_ret.push_back(ids_[i]);
     		if (removed_)
             {
@@ -816,6 +1211,7 @@ protected:
     	std::swap(ids_, other.ids_);
     	std::swap(points_, other.points_);
     	std::swap(data_ptr_, other.data_ptr_);
+    	search_contexts_.swap(other.search_contexts_);
     }
 
 protected:
@@ -884,6 +1280,11 @@ protected:
      */
     ElementType* data_ptr_;
 
+    /**
+     * Search contexts reused by the searches
+     */
+    mutable SearchContextPool search_contexts_;
+
 
 };
 
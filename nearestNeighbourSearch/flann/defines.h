@@ -116,6 +116,9 @@ enum flann_distance_t
     FLANN_DIST_HAMMING_LUT			= 10,
     FLANN_DIST_HAMMING_POPCNT   	= 11,
     FLANN_DIST_L2_SIMPLE	   		= 12,
+    FLANN_DIST_INNER_PRODUCT		= 13,
+    FLANN_DIST_COSINE				= 14,
+    FLANN_DIST_HAMMING_SIMD			= 15,
 };
 
 enum flann_datatype_t
@@ -130,7 +133,9 @@ enum flann_datatype_t
     FLANN_UINT32 	= 6,
     FLANN_UINT64 	= 7,
     FLANN_FLOAT32 	= 8,
-    FLANN_FLOAT64 	= 9
+    FLANN_FLOAT64 	= 9,
+    FLANN_FLOAT16 	= 10,
+    FLANN_BFLOAT16 	= 11
 };
 
 enum flann_checks_t {
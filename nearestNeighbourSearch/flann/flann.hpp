@@ -233,14 +233,16 @@ public:
      * \param[out] dists Distances to the nearest neighbors found
      * \param[in] knn Number of nearest neighbors to return
      * \param[in] params Search parameters
+     * \param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
      */
     int knnSearch(const Matrix<ElementType>& queries,
                                  Matrix<size_t>& indices,
                                  Matrix<DistanceType>& dists,
                                  size_t knn,
-                           const SearchParams& params) const
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->knnSearch(queries, indices, dists, knn, params);
+    	return nnIndex_->knnSearch(queries, indices, dists, knn, params, truncated);
     }
 
     /**
@@ -250,15 +252,17 @@ public:
      * @param dists
      * @param knn
      * @param params
+     * @param truncated
      * @return
      */
     int knnSearch(const Matrix<ElementType>& queries,
                                  Matrix<int>& indices,
                                  Matrix<DistanceType>& dists,
                                  size_t knn,
-                           const SearchParams& params) const
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->knnSearch(queries, indices, dists, knn, params);
+    	return nnIndex_->knnSearch(queries, indices, dists, knn, params, truncated);
     }
 
     /**
@@ -268,14 +272,16 @@ public:
      * \param[out] dists Distances to the nearest neighbors found
      * \param[in] knn Number of nearest neighbors to return
      * \param[in] params Search parameters
+     * \param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
      */
     int knnSearch(const Matrix<ElementType>& queries,
                                  std::vector< std::vector<size_t> >& indices,
                                  std::vector<std::vector<DistanceType> >& dists,
                                  size_t knn,
-                           const SearchParams& params)
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL)
     {
-    	return nnIndex_->knnSearch(queries, indices, dists, knn, params);
+    	return nnIndex_->knnSearch(queries, indices, dists, knn, params, truncated);
     }
 
     /**
@@ -285,15 +291,17 @@ public:
      * @param dists
      * @param knn
      * @param params
+     * @param truncated
      * @return
      */
     int knnSearch(const Matrix<ElementType>& queries,
                                  std::vector< std::vector<int> >& indices,
                                  std::vector<std::vector<DistanceType> >& dists,
                                  size_t knn,
-                           const SearchParams& params) const
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->knnSearch(queries, indices, dists, knn, params);
+    	return nnIndex_->knnSearch(queries, indices, dists, knn, params, truncated);
     }
 
     /**
@@ -303,15 +311,17 @@ public:
      * \param[out] dists The distances to the nearest neighbors found
      * \param[in] radius The radius used for search
      * \param[in] params Search parameters
+     * \param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
      * \returns Number of neighbors found
      */
     int radiusSearch(const Matrix<ElementType>& queries,
                                     Matrix<size_t>& indices,
                                     Matrix<DistanceType>& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params);
+    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params, truncated);
     }
 
     /**
@@ -321,15 +331,17 @@ public:
      * @param dists
      * @param radius
      * @param params
+     * @param truncated
      * @return
      */
     int radiusSearch(const Matrix<ElementType>& queries,
                                     Matrix<int>& indices,
                                     Matrix<DistanceType>& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params);
+    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params, truncated);
     }
 
     /**
@@ -339,15 +351,17 @@ public:
      * \param[out] dists The distances to the nearest neighbors found
      * \param[in] radius The radius used for search
      * \param[in] params Search parameters
+     * \param[out] truncated If not NULL, receives a flag per query, 1 when max_time_us cut it short
      * \returns Number of neighbors found
      */
     int radiusSearch(const Matrix<ElementType>& queries,
                                     std::vector< std::vector<size_t> >& indices,
                                     std::vector<std::vector<DistanceType> >& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params);
+    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params, truncated);
     }
 
     /**
@@ -357,15 +371,50 @@ public:
      * @param dists
      * @param radius
      * @param params
+     * @param truncated
      * @return
      */
     int radiusSearch(const Matrix<ElementType>& queries,
                                     std::vector< std::vector<int> >& indices,
                                     std::vector<std::vector<DistanceType> >& dists,
                                     float radius,
-                              const SearchParams& params) const
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
     {
-    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params);
+    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params, truncated);
+    }
+
+    /**
+     * \brief Perform k-nearest neighbor search with float queries in an index
+     * storing its points in a 16 bit floating point format. The queries keep
+     * their precision, the points are widened to float.
+     */
+    template <typename QueryType, typename Indices, typename Dists>
+    typename enable_if<is_query_convertible<QueryType, ElementType>::value, int>::type
+    knnSearch(const Matrix<QueryType>& queries,
+                                 Indices& indices,
+                                 Dists& dists,
+                                 size_t knn,
+                           const SearchParams& params,
+                           std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return nnIndex_->knnSearch(queries, indices, dists, knn, params, truncated);
+    }
+
+    /**
+     * \brief Perform radius search with float queries in an index storing its
+     * points in a 16 bit floating point format.
+     */
+    template <typename QueryType, typename Indices, typename Dists>
+    typename enable_if<is_query_convertible<QueryType, ElementType>::value, int>::type
+    radiusSearch(const Matrix<QueryType>& queries,
+                                    Indices& indices,
+                                    Dists& dists,
+                                    float radius,
+                              const SearchParams& params,
+                              std::vector<unsigned char>* truncated = NULL) const
+    {
+    	return nnIndex_->radiusSearch(queries, indices, dists, radius, params, truncated);
     }
 
 private:
@@ -32,6 +32,7 @@
 #define FLANN_GENERAL_H_
 
 #include "defines.h"
+#include "flann/util/half.h"
 #include <stdexcept>
 #include <cassert>
 #include <limits.h>
@@ -47,6 +48,18 @@ public:
     FLANNException(const std::string& message) : std::runtime_error(message) { }
 };
 
+/**
+ * enable_if sfinae helper
+ */
+template<bool, typename T = void> struct enable_if{};
+template<typename T> struct enable_if<true, T> { typedef T type; };
+
+/**
+ * disable_if sfinae helper
+ */
+template<bool, typename T> struct disable_if{ typedef T type; };
+template<typename T> struct disable_if<true, T> { };
+
 
 template <typename T>
 struct flann_datatype_value
@@ -119,6 +132,18 @@ struct flann_datatype_value<double>
 	static const flann_datatype_t value = FLANN_FLOAT64;
 };
 
+template<>
+struct flann_datatype_value<float16>
+{
+	static const flann_datatype_t value = FLANN_FLOAT16;
+};
+
+template<>
+struct flann_datatype_value<bfloat16>
+{
+	static const flann_datatype_t value = FLANN_BFLOAT16;
+};
+
 
 
 template <flann_datatype_t datatype>
@@ -192,6 +217,18 @@ struct flann_datatype_type<FLANN_FLOAT64>
 	typedef double type;
 };
 
+template<>
+struct flann_datatype_type<FLANN_FLOAT16>
+{
+	typedef float16 type;
+};
+
+template<>
+struct flann_datatype_type<FLANN_BFLOAT16>
+{
+	typedef bfloat16 type;
+};
+
 
 inline size_t flann_datatype_size(flann_datatype_t type)
 {
@@ -216,6 +253,10 @@ inline size_t flann_datatype_size(flann_datatype_t type)
 		return sizeof(flann_datatype_type<FLANN_FLOAT32>::type);
 	case FLANN_FLOAT64:
 		return sizeof(flann_datatype_type<FLANN_FLOAT64>::type);
+	case FLANN_FLOAT16:
+		return sizeof(flann_datatype_type<FLANN_FLOAT16>::type);
+	case FLANN_BFLOAT16:
+		return sizeof(flann_datatype_type<FLANN_BFLOAT16>::type);
 	default:
 		return 0;
 	}
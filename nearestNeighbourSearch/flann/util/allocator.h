@@ -53,6 +53,42 @@ T* allocate(size_t count = 1)
 }
 
 
+/**
+ * Allocates (using C's malloc) a generic type T, aligned to the given boundary.
+ * The memory must be released with free_aligned().
+ *
+ * Params:
+ *     count = number of instances to allocate.
+ *     alignment = required alignment in bytes, must be a power of 2.
+ * Returns: pointer (of type T*) to memory buffer
+ */
+template <typename T>
+T* allocate_aligned(size_t count, size_t alignment)
+{
+    // keep the pointer returned by malloc just before the aligned block
+    char* mem = (char*) ::malloc(sizeof(T)*count + alignment - 1 + sizeof(void*));
+    if (mem == NULL) {
+        return NULL;
+    }
+    char* aligned = mem + sizeof(void*);
+    size_t misalignment = ((size_t)aligned) & (alignment - 1);
+    if (misalignment != 0) {
+        aligned += alignment - misalignment;
+    }
+    ((void**) aligned)[-1] = mem;
+    return (T*) aligned;
+}
+
+/**
+ * Releases memory obtained from allocate_aligned().
+ */
+inline void free_aligned(void* mem)
+{
+    if (mem != NULL) {
+        ::free(((void**) mem)[-1]);
+    }
+}
+
 
 /**
  * Pooled storage allocator
@@ -212,6 +248,28 @@ public:
         return mem;
     }
 
+    /**
+     * Allocates (using this pool) a generic type T, aligned to the given boundary.
+     *
+     * Params:
+     *     count = number of instances to allocate.
+     *     alignment = required alignment in bytes, must be a power of 2.
+     * Returns: pointer (of type T*) to memory buffer
+     */
+    template <typename T>
+    T* allocateAligned(size_t count, size_t alignment)
+    {
+        char* mem = (char*) this->allocateMemory((int)(sizeof(T)*count + alignment - 1));
+        if (mem == NULL) {
+            return NULL;
+        }
+        size_t misalignment = ((size_t)mem) & (alignment - 1);
+        if (misalignment != 0) {
+            mem += alignment - misalignment;
+        }
+        return (T*) mem;
+    }
+
 };
 
 }
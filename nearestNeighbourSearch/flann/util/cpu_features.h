@@ -0,0 +1,150 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2011  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2011  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_CPU_FEATURES_H_
+#define FLANN_CPU_FEATURES_H_
+
+/*
+ * FLANN_SIMD_X86 is defined when the vectorized distance kernels for x86 are
+ * compiled in (define FLANN_NO_SIMD to leave them out). FLANN_SIMD_AVX512 is
+ * defined when the compiler also knows the AVX-512 intrinsics.
+ */
+#undef FLANN_SIMD_X86
+#undef FLANN_SIMD_AVX512
+#if !defined(FLANN_NO_SIMD) && (__amd64__ || __x86_64__ || __i386__ || _M_X64 || _M_IX86)
+#define FLANN_SIMD_X86
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__>=7) || (defined(_MSC_VER) && _MSC_VER>=1911)
+#define FLANN_SIMD_AVX512
+#endif
+#endif
+
+#include <string.h>
+
+#ifdef FLANN_SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace flann
+{
+
+/**
+ * Instruction set extensions supported by the processor and enabled by the
+ * operating system.
+ */
+struct CpuFeatures
+{
+    bool sse2;
+    bool popcnt;
+    bool avx;
+    bool avx2;
+    bool fma;
+    bool f16c;
+    bool avx512f;
+    bool avx512bw;
+    bool avx512vpopcntdq;
+};
+
+#ifdef FLANN_SIMD_X86
+
+inline void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    for (int i=0; i<4; ++i) regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/**
+ * Reads the extended control register 0, which tells which register states
+ * the operating system saves on context switches.
+ */
+inline unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+/**
+ * Queries the processor with CPUID.
+ */
+inline CpuFeatures detect_cpu_features()
+{
+    CpuFeatures features;
+    memset(&features, 0, sizeof(features));
+#ifdef FLANN_SIMD_X86
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int max_leaf = regs[0];
+    if (max_leaf<1) return features;
+
+    cpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u<<26))!=0;
+    features.popcnt = (regs[2] & (1u<<23))!=0;
+    bool osxsave = (regs[2] & (1u<<27))!=0;
+    bool avx = (regs[2] & (1u<<28))!=0;
+    bool fma = (regs[2] & (1u<<12))!=0;
+    bool f16c = (regs[2] & (1u<<29))!=0;
+
+    // the wide registers are only usable if the OS saves them
+    unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+    bool ymm_state = (xcr0 & 0x6)==0x6;
+    bool zmm_state = (xcr0 & 0xe6)==0xe6;
+
+    features.avx = avx && ymm_state;
+    features.fma = fma && ymm_state;
+    features.f16c = f16c && ymm_state;
+    if (max_leaf>=7) {
+        cpuid(7, 0, regs);
+        features.avx2 = features.avx && (regs[1] & (1u<<5))!=0;
+        features.avx512f = zmm_state && (regs[1] & (1u<<16))!=0;
+        features.avx512bw = features.avx512f && (regs[1] & (1u<<30))!=0;
+        features.avx512vpopcntdq = features.avx512f && (regs[2] & (1u<<14))!=0;
+    }
+#endif
+    return features;
+}
+
+}
+
+#endif /* FLANN_CPU_FEATURES_H_ */
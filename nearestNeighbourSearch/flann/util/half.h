@@ -0,0 +1,217 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2011  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2011  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_HALF_H_
+#define FLANN_HALF_H_
+
+#include <string.h>
+
+namespace flann
+{
+
+/*
+ * 16 bit floating point storage formats. They only hold the values: any
+ * arithmetic converts them to float, so the generic distance loops work on
+ * them unchanged, and the distance kernels convert them on the fly.
+ */
+
+inline float half_bits_to_float(unsigned short h)
+{
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int mantissa = h & 0x3ff;
+    unsigned int bits;
+    if (exponent==0x1f) {
+        // infinity or NaN
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent!=0) {
+        bits = sign | ((exponent+112) << 23) | (mantissa << 13);
+    }
+    else if (mantissa==0) {
+        bits = sign;
+    }
+    else {
+        // subnormal, normalized for float
+        exponent = 113;
+        while ((mantissa & 0x400)==0) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Rounds to the nearest half precision value, ties to even.
+ */
+inline unsigned short float_to_half_bits(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000;
+    unsigned int abs_bits = bits & 0x7fffffff;
+
+    if (abs_bits>=0x7f800000) {
+        // infinity or NaN, NaN stays quiet
+        return (unsigned short)(sign | 0x7c00 | (abs_bits>0x7f800000 ? 0x200 : 0));
+    }
+    if (abs_bits>=0x47800000) {
+        // too large, becomes infinity
+        return (unsigned short)(sign | 0x7c00);
+    }
+    if (abs_bits<0x38800000) {
+        // subnormal or zero
+        if (abs_bits<0x33000000) return (unsigned short)sign;
+        unsigned int exponent = abs_bits >> 23;
+        unsigned int mantissa = (abs_bits & 0x7fffff) | 0x800000;
+        unsigned int shift = 126-exponent;
+        unsigned int half = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift)-1);
+        unsigned int tie = 1u << (shift-1);
+        if (rest>tie || (rest==tie && (half & 1))) ++half;
+        return (unsigned short)(sign | half);
+    }
+    // the carry of the rounding may overflow into infinity, which is correct
+    unsigned int half = (abs_bits >> 13) - (112 << 10);
+    unsigned int rest = abs_bits & 0x1fff;
+    if (rest>0x1000 || (rest==0x1000 && (half & 1))) ++half;
+    return (unsigned short)(sign | half);
+}
+
+inline float bfloat16_bits_to_float(unsigned short h)
+{
+    unsigned int bits = (unsigned int)h << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Rounds to the nearest bfloat16 value, ties to even.
+ */
+inline unsigned short float_to_bfloat16_bits(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff)>0x7f800000) {
+        // NaN, stays quiet
+        return (unsigned short)((bits >> 16) | 0x40);
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (unsigned short)(bits >> 16);
+}
+
+/**
+ * IEEE 754 half precision number: 1 sign, 5 exponent and 10 mantissa bits.
+ */
+struct float16
+{
+    unsigned short bits;
+
+    float16() {}
+
+    explicit float16(float value) : bits(float_to_half_bits(value)) {}
+
+    operator float() const
+    {
+        return half_bits_to_float(bits);
+    }
+};
+
+/**
+ * Brain floating point number: the upper half of a float, with 1 sign,
+ * 8 exponent and 7 mantissa bits.
+ */
+struct bfloat16
+{
+    unsigned short bits;
+
+    bfloat16() {}
+
+    explicit bfloat16(float value) : bits(float_to_bfloat16_bits(value)) {}
+
+    operator float() const
+    {
+        return bfloat16_bits_to_float(bits);
+    }
+};
+
+/**
+ * Element type of the queries searched among points stored as Storage: float
+ * for the 16 bit formats, whose distances are computed in float (rounding the
+ * queries to the storage format would only lose precision), Storage otherwise.
+ */
+template <typename Storage>
+struct query_element
+{
+    typedef Storage type;
+};
+
+template <>
+struct query_element<float16>
+{
+    typedef float type;
+};
+
+template <>
+struct query_element<bfloat16>
+{
+    typedef float type;
+};
+
+/**
+ * Tells if points stored as Storage can be searched with queries of type
+ * Query other than Storage, the points being widened to the query type.
+ */
+template <typename Query, typename Storage>
+struct is_query_convertible
+{
+    static const bool value = false;
+};
+
+template <>
+struct is_query_convertible<float, float16>
+{
+    static const bool value = true;
+};
+
+template <>
+struct is_query_convertible<float, bfloat16>
+{
+    static const bool value = true;
+};
+
+}
+
+#endif /* FLANN_HALF_H_ */
@@ -199,6 +199,36 @@ public:
         return size_;
     }
 
+    /**
+     * @return Number of elements the heap can hold
+     */
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * Increases the capacity of the heap, keeping its elements.
+     */
+    void reserve(size_t capacity)
+    {
+        if (capacity<=capacity_) return;
+        capacity_ = capacity;
+        heap.resize(capacity/2 + capacity%2 + 1);
+    }
+
+    /**
+     * Empties the heap and brings its capacity back down, releasing the
+     * storage reserve() added.
+     */
+    void shrink(size_t capacity)
+    {
+        size_ = 0;
+        if (capacity>=capacity_) return;
+        capacity_ = capacity;
+        std::vector<Interval>(capacity/2 + capacity%2 + 1).swap(heap);
+    }
+
     /**
      * Tests if the heap is empty
      * @return true is heap empty, false otherwise
@@ -396,13 +426,24 @@ public:
 };
 
 
+/**
+ * Priority queue of a given capacity: when full, inserting drops the largest
+ * element (push never drops). A capacity of 0 makes the heap unbounded, its
+ * storage then grows as needed.
+ */
 template <typename T>
 class BoundedHeap
 {
 	IntervalHeap<T> interval_heap_;
 	size_t capacity_;
+
+	/**
+	 * Initial storage of an unbounded heap
+	 */
+	static const size_t kInitialCapacity = 64;
+
 public:
-	BoundedHeap(size_t capacity) : interval_heap_(capacity), capacity_(capacity)
+	BoundedHeap(size_t capacity) : interval_heap_(int(capacity>0 ? capacity : kInitialCapacity)), capacity_(capacity)
 	{
 
 	}
@@ -425,20 +466,48 @@ public:
     }
 
     /**
-     * Clears the heap.
+     * Clears the heap, releasing the storage push() added past the capacity.
      */
     void clear()
     {
-    	interval_heap_.clear();
+    	if (capacity_>0) {
+    		interval_heap_.shrink(capacity_);
+    	}
+    	else {
+    		interval_heap_.clear();
+    	}
     }
 
+    /**
+     * Inserts an element, dropping the largest ones to keep at most capacity
+     * elements (the value itself when it is the largest).
+     */
     void insert(const T& value)
     {
+    	if (capacity_==0) {
+    		push(value);
+    		return;
+    	}
+    	T max = T();
+    	while (interval_heap_.size()>capacity_) {
+    		interval_heap_.popMax(max);
+    	}
     	if (interval_heap_.size()==capacity_) {
-    		T max;
     		interval_heap_.getMax(max);
     		if (max<value) return;
-   			interval_heap_.popMax(max);
+    		interval_heap_.popMax(max);
+    	}
+    	interval_heap_.insert(value);
+    }
+
+    /**
+     * Inserts an element without dropping any: the heap may grow past its
+     * capacity, until the next insert drops the largest elements again.
+     */
+    void push(const T& value)
+    {
+    	if (interval_heap_.size()==interval_heap_.capacity()) {
+    		interval_heap_.reserve(2*interval_heap_.capacity());
     	}
     	interval_heap_.insert(value);
     }
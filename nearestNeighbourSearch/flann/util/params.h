@@ -67,6 +67,7 @@ struct SearchParams
     	use_heap = FLANN_Undefined;
     	cores = 1;
     	matrices_in_gpu_ram = false;
+    	max_time_us = -1;
     }
 
     // how many leafs to visit when searching for neighbours (-1 for unlimited)
@@ -83,6 +84,9 @@ struct SearchParams
     int cores;
     // for GPU search indicates if matrices are already in GPU ram
     bool matrices_in_gpu_ram;
+    // time budget of each query in microseconds, when it runs out the best neighbors found so far are returned (-1 for unlimited);
+    // the queries cut short are reported by the truncated output of the searches, or by ResultSet::truncated()
+    int max_time_us;
 };
 
 
@@ -130,6 +134,7 @@ inline void print_params(const SearchParams& params)
 	std::cout << "eps : " << params.eps << std::endl;
 	std::cout << "sorted : " << params.sorted << std::endl;
 	std::cout << "max_neighbors : " << params.max_neighbors << std::endl;
+	std::cout << "max_time_us : " << params.max_time_us << std::endl;
 }
 
 
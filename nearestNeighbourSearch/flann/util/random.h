@@ -35,6 +35,7 @@
 #include <cstdlib>
 #include <cstddef>
 #include <vector>
+#include <stdint.h>
 
 #include "flann/general.h"
 
@@ -83,6 +84,59 @@ public:
 };
 
 
+/**
+ * Random number generator with its own state (xorshift64*), for the code
+ * running in several threads at once: std::rand() has a single state, so the
+ * numbers one thread gets would depend on the other threads.
+ */
+class RandomStream
+{
+public:
+    explicit RandomStream(unsigned int seed = 1)
+    {
+        this->seed(seed);
+    }
+
+    /**
+     * Restarts the sequence from a seed
+     */
+    void seed(unsigned int seed)
+    {
+        state_ = (uint64_t(seed)+1) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    /**
+     * Generates a random double value in [low, high)
+     */
+    double rand_double(double high = 1.0, double low = 0)
+    {
+        return low + (high-low) * unit();
+    }
+
+    /**
+     * Generates a random integer value in [low, high)
+     */
+    int rand_int(int high = RAND_MAX, int low = 0)
+    {
+        return low + (int) (double(high-low) * unit());
+    }
+
+    ptrdiff_t operator() (ptrdiff_t i) { return rand_int(int(i)); }
+
+private:
+    double unit()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        // the 53 high bits of the product, scaled to [0, 1)
+        return double((state_ * 0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+    }
+
+    uint64_t state_;
+};
+
+
 /**
  * Random number generator that returns a distinct number from
  * the [0,n) interval each time.
@@ -104,6 +158,14 @@ public:
         init(n);
     }
 
+    /**
+     * Constructor drawing from the given generator instead of std::rand().
+     */
+    UniqueRandom(int n, RandomStream& random)
+    {
+        init(n, random);
+    }
+
     /**
      * Initializes the number generator.
      * @param n the size of the interval from which to generate random numbers.
@@ -122,6 +184,20 @@ public:
         counter_ = 0;
     }
 
+    /**
+     * Initializes the number generator, drawing from the given generator.
+     */
+    void init(int n, RandomStream& random)
+    {
+        vals_.resize(n);
+        size_ = n;
+        for (int i = 0; i < size_; ++i) vals_[i] = i;
+
+        std::random_shuffle(vals_.begin(), vals_.end(), random);
+
+        counter_ = 0;
+    }
+
     /**
      * Return a distinct random integer in greater or equal to 0 and less
      * than 'n' on each call. It should be called maximum 'n' times.
@@ -82,6 +82,8 @@ template <typename DistanceType>
 class ResultSet
 {
 public:
+    ResultSet() : truncated_(false) {}
+
     virtual ~ResultSet() {}
 
     virtual bool full() const = 0;
@@ -90,6 +92,22 @@ public:
 
     virtual DistanceType worstDist() const = 0;
 
+    /**
+     * Tells if the search that filled the set was stopped by its time budget
+     * before completing (the neighbors are then the best found so far)
+     */
+    bool truncated() const
+    {
+        return truncated_;
+    }
+
+    void setTruncated(bool truncated)
+    {
+        truncated_ = truncated;
+    }
+
+private:
+    bool truncated_;
 };
 
 /**
@@ -29,7 +29,9 @@
 #ifndef FLANN_SAVING_H_
 #define FLANN_SAVING_H_
 
+#include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 #include <stdio.h>
 
@@ -42,6 +44,15 @@
 #endif
 #define FLANN_SIGNATURE_ "FLANN_INDEX_v1.0"
 
+/**
+ * Oldest FLANN version whose saved indices can still be loaded. Bump it
+ * together with FLANN_VERSION_ whenever the serialized layout changes.
+ */
+#ifdef FLANN_INDEX_FORMAT_VERSION_
+#undef FLANN_INDEX_FORMAT_VERSION_
+#endif
+#define FLANN_INDEX_FORMAT_VERSION_ "1.8.5"
+
 namespace flann
 {
 
@@ -79,6 +90,40 @@ private:
     friend struct serialization::access;
 };
 
+/**
+ * Compares two dotted version strings ("1.8.4") numerically.
+ *
+ * @return negative, zero or positive when a is older, equal or newer than b
+ */
+inline int compare_versions(const char* a, const char* b)
+{
+    char* end;
+    while (*a || *b) {
+        long va = strtol(a, &end, 10); a = end;
+        long vb = strtol(b, &end, 10); b = end;
+        if (va!=vb) return va<vb ? -1 : 1;
+        if (*a!='.' && *b!='.') break;
+        if (*a=='.') ++a;
+        if (*b=='.') ++b;
+    }
+    return 0;
+}
+
+/**
+ * Checks that an index header was written in a format this version can read.
+ */
+inline void check_header_version(const IndexHeader& header)
+{
+    char version[sizeof(header.h.version)+1];
+    memcpy(version, header.h.version, sizeof(header.h.version));
+    version[sizeof(header.h.version)] = 0;
+
+    if (compare_versions(version, FLANN_INDEX_FORMAT_VERSION_)<0) {
+        throw FLANNException(std::string("Saved index was written by FLANN ") + version +
+                ", its format is no longer supported (needs " FLANN_INDEX_FORMAT_VERSION_ " or newer), the index has to be rebuilt.");
+    }
+}
+
 /**
  * Saves index header to stream
  *
@@ -117,6 +162,7 @@ inline IndexHeader load_header(FILE* stream)
                 strlen(FLANN_SIGNATURE_)) != 0) {
         throw FLANNException("Invalid index file, wrong signature");
     }
+    check_header_version(header);
 
     return header;
 }
@@ -33,6 +33,28 @@
 
 #include <time.h>
 
+#ifdef _WIN32
+// the declarations of the SDK, without the min/max macros and the rarely used
+// parts of the API (the macros are only defined around the include)
+#ifndef NOMINMAX
+#define NOMINMAX
+#define FLANN_TIMER_NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define FLANN_TIMER_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef FLANN_TIMER_NOMINMAX
+#undef NOMINMAX
+#undef FLANN_TIMER_NOMINMAX
+#endif
+#ifdef FLANN_TIMER_LEAN_AND_MEAN
+#undef WIN32_LEAN_AND_MEAN
+#undef FLANN_TIMER_LEAN_AND_MEAN
+#endif
+#endif
+
 
 namespace flann
 {
@@ -90,6 +112,29 @@ public:
 
 };
 
+
+/**
+ * Reads a monotonic clock with sub-microsecond resolution (clock() is neither
+ * monotonic nor precise enough to bound the duration of a single query).
+ *
+ * @return time in microseconds from an arbitrary origin
+ */
+inline double monotonic_time_us()
+{
+#ifdef _WIN32
+    // the frequency is fixed at boot and cheap to read; it is not cached in a
+    // static, whose initialization the v120 toolset does not make thread-safe
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1e6 / (double)frequency.QuadPart;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+#endif
+}
+
 }
 
 #endif // FLANN_TIMER_H
@@ -0,0 +1,222 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2011  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2011  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_VISITED_SET_H_
+#define FLANN_VISITED_SET_H_
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+namespace flann
+{
+
+/**
+ * Set of the point indices visited by one query.
+ *
+ * Two representations are available, both cleared by bumping an epoch counter
+ * instead of zeroing memory:
+ *  - a dense array holding for every point the epoch in which it was last
+ *    visited, used when a query is expected to touch a large part of the dataset.
+ *    The epochs are single bytes (one byte per point and searching thread),
+ *    so the array is zeroed once every 255 queries when the epoch wraps around;
+ *  - a small open-addressing hash table of the visited indices, used when a
+ *    query touches only a few points, so that the set stays in L1/L2 cache.
+ *
+ * The hash table is chosen when the expected number of visits times
+ * kSparseRatio (64) is less than the dataset size, i.e. when a query is
+ * expected to visit less than 1/64 of the points. The table then takes 32 to
+ * 64 bytes per expected visit (16 byte slots, a power of two of at least twice
+ * the expected visits), which is less than the one byte per point array.
+ */
+class VisitedSet
+{
+    struct Slot
+    {
+        size_t index;
+        unsigned int epoch;
+    };
+
+    /**
+     * The hash table is used when the expected number of visits is
+     * less than 1/kSparseRatio of the dataset size.
+     */
+    static const size_t kSparseRatio = 64;
+
+    /**
+     * Largest epoch of the dense array before it wraps around
+     */
+    static const unsigned int kMaxDenseEpoch = 255;
+    static const size_t kMinSlots = 64;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param size number of points in the dataset
+     * @param expected_visits number of points a query is expected to visit
+     */
+    VisitedSet(size_t size, size_t expected_visits) : epoch_(1), count_(0)
+    {
+        sparse_ = expected_visits*kSparseRatio < size;
+        if (sparse_) {
+            size_t slots = kMinSlots;
+            while (slots < 2*expected_visits) slots *= 2;
+            initSlots(slots);
+        }
+        else {
+            stamps_.resize(size, 0);
+        }
+    }
+
+    /**
+     * @return true if the hash table representation is used
+     */
+    bool sparse() const
+    {
+        return sparse_;
+    }
+
+    /**
+     * Removes all the indices from the set.
+     */
+    void clear()
+    {
+        count_ = 0;
+        ++epoch_;
+        if (!sparse_ && epoch_ > kMaxDenseEpoch) {
+            // the one byte stamps wrapped around, stale stamps must go
+            std::fill(stamps_.begin(), stamps_.end(), 0);
+            epoch_ = 1;
+        }
+        else if (epoch_ == 0) {
+            // the epoch counter wrapped around, stale slots must go
+            for (size_t i=0; i<slots_.size(); ++i) {
+                slots_[i].epoch = 0;
+            }
+            epoch_ = 1;
+        }
+    }
+
+    /**
+     * Checks if an index is in the set.
+     */
+    bool test(size_t index) const
+    {
+        if (!sparse_) {
+            return stamps_[index] == epoch_;
+        }
+        for (size_t pos = hash(index);; pos = (pos+1) & mask_) {
+            const Slot& slot = slots_[pos];
+            if (slot.epoch != epoch_) return false;
+            if (slot.index == index) return true;
+        }
+    }
+
+    /**
+     * Adds an index to the set.
+     *
+     * @return false if the index was already in the set
+     */
+    bool insert(size_t index)
+    {
+        if (!sparse_) {
+            if (stamps_[index] == epoch_) return false;
+            stamps_[index] = (uint8_t)epoch_;
+            return true;
+        }
+
+        size_t pos = hash(index);
+        for (;; pos = (pos+1) & mask_) {
+            Slot& slot = slots_[pos];
+            if (slot.epoch != epoch_) break;
+            if (slot.index == index) return false;
+        }
+        slots_[pos].index = index;
+        slots_[pos].epoch = epoch_;
+        if (2*(++count_) > slots_.size()) {
+            grow();
+        }
+        return true;
+    }
+
+private:
+    size_t hash(size_t index) const
+    {
+        // Fibonacci hashing, the top bits of the product are the best mixed
+        return (size_t)((uint64_t(index) * 0x9E3779B97F4A7C15ULL) >> shift_);
+    }
+
+    void initSlots(size_t slots)
+    {
+        Slot empty;
+        empty.index = 0;
+        empty.epoch = 0;
+        slots_.assign(slots, empty);
+        mask_ = slots - 1;
+        shift_ = 64;
+        while (slots > 1) {
+            slots >>= 1;
+            --shift_;
+        }
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old_slots;
+        old_slots.swap(slots_);
+        initSlots(old_slots.size()*2);
+        for (size_t i=0; i<old_slots.size(); ++i) {
+            if (old_slots[i].epoch != epoch_) continue;
+            size_t pos = hash(old_slots[i].index);
+            while (slots_[pos].epoch == epoch_) {
+                pos = (pos+1) & mask_;
+            }
+            slots_[pos] = old_slots[i];
+        }
+    }
+
+private:
+    bool sparse_;
+    unsigned int epoch_;
+
+    /** Dense representation: epoch of the last visit of every point */
+    std::vector<uint8_t> stamps_;
+
+    /** Sparse representation: open-addressing table with linear probing */
+    std::vector<Slot> slots_;
+    size_t mask_;
+    int shift_;
+    size_t count_;
+};
+
+}
+
+#endif /* FLANN_VISITED_SET_H_ */
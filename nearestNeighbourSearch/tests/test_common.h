@@ -0,0 +1,142 @@
+/*
+ * Helpers shared by the test programs. Every test is a standalone program that
+ * prints the failed checks and exits with a non-zero status if there was one.
+ *
+ * Build a test from this directory with
+ *
+ *   gcc -O2 -c ../flann/ext/lz4.c ../flann/ext/lz4hc.c
+ *   g++ -std=c++11 -O2 -fopenmp -I.. -I../flann test_<name>.cpp lz4.o lz4hc.o -o test_<name>
+ */
+
+#ifndef FLANN_TEST_COMMON_H_
+#define FLANN_TEST_COMMON_H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "flann/util/cpu_features.h"
+
+namespace test
+{
+
+static int failures = 0;
+
+/**
+ * Records a failure when cond is false, printing the message (printf format).
+ */
+#define TEST_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            ++test::failures; \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+/**
+ * Prints the outcome of a test program.
+ *
+ * @return the exit status of the program
+ */
+inline int report(const char* name)
+{
+    if (failures>0) {
+        printf("%s: %d check(s) FAILED\n", name, failures);
+        return 1;
+    }
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+/**
+ * Tells if two results agree up to a relative error (absolute for values under 1).
+ */
+inline bool close(double a, double b, double tolerance)
+{
+    double scale = std::fabs(b)>1 ? std::fabs(b) : 1;
+    return std::fabs(a-b)<=tolerance*scale;
+}
+
+inline double uniform()
+{
+    return (double)rand()/RAND_MAX;
+}
+
+/**
+ * Points around a few centers, so that the trees have clusters to find;
+ * positive histogram-like values for the distances that need them.
+ */
+template <typename T>
+std::vector<T> random_points(size_t rows, size_t cols, bool positive, double scale = 1)
+{
+    const size_t clusters = 10;
+    std::vector<double> centers(clusters*cols);
+    for (size_t i=0; i<centers.size(); ++i) {
+        centers[i] = positive ? uniform() : 2*uniform()-1;
+    }
+    std::vector<T> points(rows*cols);
+    for (size_t i=0; i<rows; ++i) {
+        const double* center = &centers[(rand()%clusters)*cols];
+        for (size_t j=0; j<cols; ++j) {
+            double value = center[j]+0.3*(uniform()-0.5);
+            if (positive && value<0) value = 0;
+            points[i*cols+j] = T(scale*value);
+        }
+    }
+    return points;
+}
+
+/**
+ * Subsets of the features of this processor, from none to all of them, to
+ * select every kernel of a family it can run.
+ */
+inline std::vector<flann::CpuFeatures> feature_levels()
+{
+    flann::CpuFeatures detected = flann::detect_cpu_features();
+    flann::CpuFeatures level;
+    memset(&level, 0, sizeof(level));
+
+    std::vector<flann::CpuFeatures> levels;
+    levels.push_back(level);
+    level.sse2 = detected.sse2;
+    levels.push_back(level);
+    level.popcnt = detected.popcnt;
+    levels.push_back(level);
+    level.avx = detected.avx;
+    level.avx2 = detected.avx2;
+    level.fma = detected.fma;
+    level.f16c = detected.f16c;
+    levels.push_back(level);
+    levels.push_back(detected);
+    return levels;
+}
+
+#ifdef FLANN_SIMD_X86
+/**
+ * The distinct kernels of a family this processor can run, the scalar one
+ * first.
+ */
+template <typename Family>
+std::vector<typename Family::Function> kernels()
+{
+    std::vector<flann::CpuFeatures> levels = feature_levels();
+    std::vector<typename Family::Function> result;
+    for (size_t i=0; i<levels.size(); ++i) {
+        typename Family::Function function = Family::select(levels[i]);
+        bool seen = false;
+        for (size_t j=0; j<result.size(); ++j) {
+            if (result[j]==function) seen = true;
+        }
+        if (!seen) result.push_back(function);
+    }
+    return result;
+}
+#endif
+
+}
+
+#endif /* FLANN_TEST_COMMON_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Checks the Hamming distance kernels and HammingSimd against the byte lookup
+ * table of HammingLUT, on every length up to a few vectors (most of them not a
+ * multiple of the vector width), and exact searches with HammingSimd against
+ * a brute force search.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "flann/flann.hpp"
+#include "test_common.h"
+
+using namespace flann;
+
+namespace
+{
+
+std::vector<unsigned char> random_bytes(size_t count)
+{
+    std::vector<unsigned char> bytes(count);
+    for (size_t i=0; i<count; ++i) {
+        bytes[i] = (unsigned char)(rand()&0xff);
+    }
+    return bytes;
+}
+
+void check_kernels()
+{
+    const size_t max_length = 300;
+    // one extra byte so that the vectors start unaligned as well
+    std::vector<unsigned char> a = random_bytes(max_length+1);
+    std::vector<unsigned char> b = random_bytes(max_length+1);
+    HammingLUT lut;
+
+    for (size_t offset=0; offset<2; ++offset) {
+        const unsigned char* pa = &a[offset];
+        const unsigned char* pb = &b[0];
+        for (size_t length=0; length<=max_length-offset; ++length) {
+            unsigned int expected = (unsigned int)lut(pa, pb, (int)length);
+
+#ifdef FLANN_SIMD_X86
+            std::vector<simd::HammingBytes::Function> functions = test::kernels<simd::HammingBytes>();
+            for (size_t k=0; k<functions.size(); ++k) {
+                unsigned int result = functions[k](pa, pb, length, 0);
+                TEST_CHECK(result==expected, "kernel %u, length %u: %u instead of %u",
+                           (unsigned)k, (unsigned)length, result, expected);
+            }
+#endif
+            unsigned int result = HammingSimd<unsigned char>()(pa, pb, length);
+            TEST_CHECK(result==expected, "HammingSimd, length %u: %u instead of %u",
+                       (unsigned)length, result, expected);
+
+            // Hamming ignores a partial last word
+            if (length%8==0) {
+                unsigned int reference = Hamming<unsigned char>()(pa, pb, length);
+                TEST_CHECK(result==reference, "Hamming, length %u: %u instead of %u",
+                           (unsigned)length, reference, result);
+            }
+        }
+    }
+
+    // other element types count the bits of size*sizeof(T) bytes
+    for (size_t length=0; length<=max_length/4; ++length) {
+        unsigned int expected = (unsigned int)lut(&a[0], &b[0], (int)(4*length));
+        unsigned int result = HammingSimd<unsigned int>()((const unsigned int*)&a[0], (const unsigned int*)&b[0], length);
+        TEST_CHECK(result==expected, "HammingSimd<unsigned int>, length %u: %u instead of %u",
+                   (unsigned)length, result, expected);
+    }
+}
+
+void check_exact_search()
+{
+    const size_t rows = 3000;
+    const size_t cols = 37;
+    const size_t query_rows = 50;
+    const size_t knn = 5;
+    std::vector<unsigned char> points = random_bytes(rows*cols);
+    std::vector<unsigned char> queries = random_bytes(query_rows*cols);
+    Matrix<unsigned char> dataset(&points[0], rows, cols);
+    Matrix<unsigned char> query(&queries[0], query_rows, cols);
+
+    MultiThreadIndex<HammingSimd<unsigned char> > index((MultiThreadHierarchicalIndexParams(16, FLANN_CENTERS_RANDOM, 2, 20)));
+    index.addPoints(dataset);
+
+    std::vector<std::vector<size_t> > indices;
+    std::vector<std::vector<unsigned int> > dists;
+    index.knnSearch(query, indices, dists, knn, SearchParams(FLANN_CHECKS_UNLIMITED));
+
+    HammingLUT lut;
+    for (size_t i=0; i<query_rows; ++i) {
+        std::vector<int> expected(rows);
+        for (size_t j=0; j<rows; ++j) {
+            expected[j] = lut(query[i], dataset[j], (int)cols);
+        }
+        std::sort(expected.begin(), expected.end());
+        TEST_CHECK(dists[i].size()==knn, "query %u: %u neighbors", (unsigned)i, (unsigned)dists[i].size());
+        for (size_t k=0; k<dists[i].size() && k<knn; ++k) {
+            TEST_CHECK((int)dists[i][k]==expected[k], "query %u, neighbor %u: distance %u instead of %d",
+                       (unsigned)i, (unsigned)k, dists[i][k], expected[k]);
+            TEST_CHECK(lut(query[i], dataset[indices[i][k]], (int)cols)==(int)dists[i][k],
+                       "query %u, neighbor %u: wrong index", (unsigned)i, (unsigned)k);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    srand(1);
+    check_kernels();
+    check_exact_search();
+    return test::report("test_hamming");
+}
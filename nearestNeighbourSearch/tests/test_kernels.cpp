@@ -0,0 +1,473 @@
+/*
+ * Checks every kernel of the distance families this processor can run (the
+ * scalar one, SSE2, AVX2 and AVX-512) against a double precision reference,
+ * on all the lengths up to a few vectors and on some long odd lengths, from
+ * aligned and unaligned starts. With a worst distance below the distance,
+ * the kernels that stop early must still return more than it.
+ *
+ * The Hamming kernels are checked by test_hamming.cpp.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "flann/algorithms/dist.h"
+#include "test_common.h"
+
+using namespace flann;
+
+namespace
+{
+
+const size_t kLongLengths[] = { 255, 1000, 1001, 4099 };
+const size_t kMaxShortLength = 130;
+
+/**
+ * A reference distance, with the magnitude of its terms to scale the error.
+ */
+struct Reference
+{
+    double value;
+    double magnitude;
+
+    Reference() : value(0), magnitude(0) {}
+};
+
+/**
+ * Random floats in [-1,1], or histogram bins in [0,1] with a tenth of zeros.
+ */
+std::vector<float> random_floats(size_t count, bool histogram)
+{
+    std::vector<float> values(count);
+    for (size_t i=0; i<count; ++i) {
+        if (histogram) {
+            values[i] = rand()%10==0 ? 0 : (float)test::uniform();
+        }
+        else {
+            values[i] = (float)(2*test::uniform()-1);
+        }
+    }
+    return values;
+}
+
+#ifdef FLANN_SIMD_X86
+
+std::vector<size_t> lengths()
+{
+    std::vector<size_t> result;
+    for (size_t length=0; length<=kMaxShortLength; ++length) {
+        result.push_back(length);
+    }
+    result.insert(result.end(), kLongLengths, kLongLengths+sizeof(kLongLengths)/sizeof(kLongLengths[0]));
+    return result;
+}
+
+/**
+ * Runs the kernels of Family on a and b (both one element longer than the
+ * longest length, for the unaligned starts) and compares them with reference.
+ */
+template <typename Family, typename T, typename Q, typename ReferenceFunction>
+void check_family(const char* name, const std::vector<T>& a, const std::vector<Q>& b,
+                  ReferenceFunction reference, double tolerance, bool early_exit)
+{
+    std::vector<typename Family::Function> functions = test::kernels<Family>();
+    std::vector<size_t> all_lengths = lengths();
+    for (size_t offset=0; offset<2; ++offset) {
+        for (size_t l=0; l<all_lengths.size(); ++l) {
+            size_t length = all_lengths[l];
+            const T* pa = &a[offset];
+            const Q* pb = &b[0];
+            Reference expected = reference(pa, pb, length);
+            double scale = expected.magnitude>1 ? expected.magnitude : 1;
+
+            for (size_t k=0; k<functions.size(); ++k) {
+                double result = functions[k](pa, pb, length, 0);
+                TEST_CHECK(std::fabs(result-expected.value)<=tolerance*scale,
+                           "%s kernel %u, length %u, offset %u: %g instead of %g",
+                           name, (unsigned)k, (unsigned)length, (unsigned)offset, result, expected.value);
+
+                if (early_exit && expected.value>0) {
+                    float worst = (float)(expected.value/2);
+                    double partial = functions[k](pa, pb, length, worst);
+                    TEST_CHECK(partial>worst, "%s kernel %u, length %u: early exit at %g with worst distance %g",
+                               name, (unsigned)k, (unsigned)length, partial, (double)worst);
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+/**
+ * Element values as the kernels see them: bytes may be signed, the 16 bit
+ * formats are given by their bits.
+ */
+template <typename T>
+struct Values
+{
+    static double get(const T* p, size_t i) { return (double)p[i]; }
+};
+
+template <bool Signed>
+struct ByteValues
+{
+    static double get(const unsigned char* p, size_t i) { return Signed ? (double)(signed char)p[i] : (double)p[i]; }
+};
+
+template <typename Format>
+struct HalfValues
+{
+    static double get(const unsigned short* p, size_t i) { return Format::to_float(p[i]); }
+};
+
+template <typename ValuesA, typename ValuesB = ValuesA>
+struct SquaredL2Reference
+{
+    template <typename T, typename Q>
+    Reference operator()(const T* a, const Q* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            double diff = ValuesA::get(a, i)-ValuesB::get(b, i);
+            r.value += diff*diff;
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+template <typename Values>
+struct L1Reference
+{
+    template <typename T>
+    Reference operator()(const T* a, const T* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            r.value += std::fabs(Values::get(a, i)-Values::get(b, i));
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+struct PowReference
+{
+    int order;
+
+    explicit PowReference(int order_) : order(order_) {}
+
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            r.value += std::pow(std::fabs((double)a[i]-b[i]), order);
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+struct MaxReference
+{
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            double diff = std::fabs((double)a[i]-b[i]);
+            if (diff>r.value) r.value = diff;
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+struct HistIntersectionReference
+{
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            r.value += a[i]<b[i] ? a[i] : b[i];
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+struct ChiSquareReference
+{
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            double sum = (double)a[i]+b[i];
+            if (sum>0) {
+                double diff = (double)a[i]-b[i];
+                r.value += diff*diff/sum;
+            }
+        }
+        r.magnitude = r.value;
+        return r;
+    }
+};
+
+struct KLReference
+{
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        for (size_t i=0; i<size; ++i) {
+            if (a[i]!=0 && b[i]!=0) {
+                double term = a[i]*std::log((double)a[i]/b[i]);
+                r.value += term;
+                r.magnitude += std::fabs(term);
+            }
+        }
+        return r;
+    }
+};
+
+template <typename ValuesA, typename ValuesB = ValuesA>
+struct InnerProductReference
+{
+    template <typename T, typename Q>
+    Reference operator()(const T* a, const Q* b, size_t size) const
+    {
+        Reference r;
+        double dot = 0;
+        for (size_t i=0; i<size; ++i) {
+            double term = ValuesA::get(a, i)*ValuesB::get(b, i);
+            dot += term;
+            r.magnitude += std::fabs(term);
+        }
+        r.value = 1-dot;
+        r.magnitude += 1;
+        return r;
+    }
+};
+
+struct CosineReference
+{
+    Reference operator()(const float* a, const float* b, size_t size) const
+    {
+        Reference r;
+        double dot = 0, norm_a = 0, norm_b = 0;
+        for (size_t i=0; i<size; ++i) {
+            dot += (double)a[i]*b[i];
+            norm_a += (double)a[i]*a[i];
+            norm_b += (double)b[i]*b[i];
+        }
+        r.value = norm_a*norm_b>0 ? 1-dot/std::sqrt(norm_a*norm_b) : 1;
+        r.magnitude = 1;
+        return r;
+    }
+};
+
+#ifdef FLANN_SIMD_X86
+
+void check_float_kernels()
+{
+    size_t count = kLongLengths[sizeof(kLongLengths)/sizeof(kLongLengths[0])-1]+1;
+    std::vector<float> a = random_floats(count, false);
+    std::vector<float> b = random_floats(count, false);
+    std::vector<float> ha = random_floats(count, true);
+    std::vector<float> hb = random_floats(count, true);
+    const double tolerance = 1e-5;
+
+    check_family<simd::L2Float>("L2", a, b, SquaredL2Reference<Values<float> >(), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::AbsDiffOp> >("L1", a, b, L1Reference<Values<float> >(), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::PowAbsDiffOp<3> > >("Minkowski3", a, b, PowReference(3), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::PowAbsDiffOp<4> > >("Minkowski4", a, b, PowReference(4), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::MaxAbsDiffOp> >("Max", a, b, MaxReference(), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::MinOp> >("HistIntersection", ha, hb, HistIntersectionReference(), tolerance, true);
+    check_family<simd::ElementwiseFloat<simd::ChiSquareOp> >("ChiSquare", ha, hb, ChiSquareReference(), tolerance, true);
+    check_family<simd::KLFloat>("KL", ha, hb, KLReference(), tolerance, false);
+    check_family<simd::InnerProductFloat>("InnerProduct", a, b, InnerProductReference<Values<float> >(), tolerance, false);
+    check_family<simd::CosineFloat>("Cosine", a, b, CosineReference(), tolerance, false);
+}
+
+/**
+ * The fixed length kernels, for lengths around the vector widths.
+ */
+template <size_t N>
+void check_fixed_length(const std::vector<float>& a, const std::vector<float>& b)
+{
+    typedef simd::L2FloatLength<simd::FixedLength<N> > Family;
+    std::vector<typename Family::Function> functions = test::kernels<Family>();
+    Reference expected = SquaredL2Reference<Values<float> >()(&a[0], &b[0], N);
+    for (size_t k=0; k<functions.size(); ++k) {
+        double result = functions[k](&a[0], &b[0], N, 0);
+        TEST_CHECK(test::close(result, expected.value, 1e-5), "L2 fixed length %u kernel %u: %g instead of %g",
+                   (unsigned)N, (unsigned)k, result, expected.value);
+    }
+    TEST_CHECK(test::close(L2Fixed<float, N>()(&a[0], &b[0], N), expected.value, 1e-5),
+               "L2Fixed<float, %u>", (unsigned)N);
+}
+
+void check_fixed_length_kernels()
+{
+    std::vector<float> a = random_floats(200, false);
+    std::vector<float> b = random_floats(200, false);
+    check_fixed_length<1>(a, b);
+    check_fixed_length<3>(a, b);
+    check_fixed_length<4>(a, b);
+    check_fixed_length<7>(a, b);
+    check_fixed_length<8>(a, b);
+    check_fixed_length<15>(a, b);
+    check_fixed_length<16>(a, b);
+    check_fixed_length<31>(a, b);
+    check_fixed_length<33>(a, b);
+    check_fixed_length<128>(a, b);
+    check_fixed_length<131>(a, b);
+}
+
+void check_byte_kernels()
+{
+    size_t count = kLongLengths[sizeof(kLongLengths)/sizeof(kLongLengths[0])-1]+1;
+    std::vector<unsigned char> a(count), b(count);
+    for (size_t i=0; i<count; ++i) {
+        a[i] = (unsigned char)(rand()&0xff);
+        b[i] = (unsigned char)(rand()&0xff);
+    }
+    // the sums are exact integers, only their conversion to float rounds
+    const double tolerance = 1e-7;
+    check_family<simd::L2Byte<false> >("L2<unsigned char>", a, b, SquaredL2Reference<ByteValues<false> >(), tolerance, true);
+    check_family<simd::L2Byte<true> >("L2<signed char>", a, b, SquaredL2Reference<ByteValues<true> >(), tolerance, true);
+    check_family<simd::L1Byte<false> >("L1<unsigned char>", a, b, L1Reference<ByteValues<false> >(), tolerance, true);
+    check_family<simd::L1Byte<true> >("L1<signed char>", a, b, L1Reference<ByteValues<true> >(), tolerance, true);
+}
+
+template <typename Format, typename Storage>
+void check_half_kernels(const char* l2_name, const char* l2_float_name, const char* ip_name, const char* ip_float_name)
+{
+    size_t count = kLongLengths[sizeof(kLongLengths)/sizeof(kLongLengths[0])-1]+1;
+    std::vector<float> fa = random_floats(count, false);
+    std::vector<float> fb = random_floats(count, false);
+    std::vector<unsigned short> a(count), b(count);
+    for (size_t i=0; i<count; ++i) {
+        a[i] = Storage(fa[i]).bits;
+        b[i] = Storage(fb[i]).bits;
+    }
+    // the products of the converted values are exact in float
+    const double tolerance = 1e-5;
+    typedef HalfValues<Format> H;
+    check_family<simd::L2Half<Format> >(l2_name, a, b, SquaredL2Reference<H>(), tolerance, true);
+    check_family<simd::L2Half<Format, simd::FloatFormat> >(l2_float_name, a, fb, SquaredL2Reference<H, Values<float> >(), tolerance, true);
+    check_family<simd::InnerProductHalf<Format> >(ip_name, a, b, InnerProductReference<H>(), tolerance, false);
+    check_family<simd::InnerProductHalf<Format, simd::FloatFormat> >(ip_float_name, a, fb, InnerProductReference<H, Values<float> >(), tolerance, false);
+}
+
+void check_l2_3d_block_kernels()
+{
+    std::vector<simd::L2_3DBlockFloat::Function> functions = test::kernels<simd::L2_3DBlockFloat>();
+    const size_t stride = 80;
+    std::vector<float> block = random_floats(3*stride, false);
+    std::vector<float> vec = random_floats(3, false);
+    std::vector<float> dists(stride+1);
+    for (size_t count=0; count<=stride; ++count) {
+        for (size_t k=0; k<functions.size(); ++k) {
+            // the value past the last distance must not be written
+            dists.assign(stride+1, -1.0f);
+            functions[k](&vec[0], &block[0], count, stride, &dists[0]);
+            for (size_t i=0; i<count; ++i) {
+                double expected = 0;
+                for (size_t c=0; c<3; ++c) {
+                    double diff = (double)block[c*stride+i]-vec[c];
+                    expected += diff*diff;
+                }
+                TEST_CHECK(test::close(dists[i], expected, 1e-5), "L2_3D block kernel %u, count %u, point %u: %g instead of %g",
+                           (unsigned)k, (unsigned)count, (unsigned)i, (double)dists[i], expected);
+            }
+            TEST_CHECK(dists[count]==-1.0f, "L2_3D block kernel %u, count %u: wrote past the block", (unsigned)k, (unsigned)count);
+        }
+    }
+}
+
+void check_dot_block_kernels()
+{
+    std::vector<simd::DotBlockFloat::Function> functions = test::kernels<simd::DotBlockFloat>();
+    const size_t dims[] = { 1, 3, 17, 64 };
+    for (size_t d=0; d<sizeof(dims)/sizeof(dims[0]); ++d) {
+        size_t dim = dims[d];
+        for (size_t ldb=16; ldb<=48; ldb+=16) {
+            for (size_t na=1; na<=9; ++na) {
+                std::vector<float> a_values = random_floats(na*dim, false);
+                std::vector<const float*> a(na);
+                for (size_t i=0; i<na; ++i) a[i] = &a_values[i*dim];
+                std::vector<float> b = random_floats(dim*ldb, false);
+                std::vector<float> out(na*ldb);
+                for (size_t k=0; k<functions.size(); ++k) {
+                    functions[k](&a[0], na, &b[0], ldb, dim, &out[0]);
+                    for (size_t i=0; i<na; ++i) {
+                        for (size_t j=0; j<ldb; ++j) {
+                            double expected = 0, magnitude = 1;
+                            for (size_t c=0; c<dim; ++c) {
+                                expected += (double)a[i][c]*b[c*ldb+j];
+                                magnitude += std::fabs((double)a[i][c]*b[c*ldb+j]);
+                            }
+                            TEST_CHECK(std::fabs(out[i*ldb+j]-expected)<=1e-5*magnitude,
+                                       "dot block kernel %u, dim %u, %u x %u: %g instead of %g at (%u, %u)",
+                                       (unsigned)k, (unsigned)dim, (unsigned)na, (unsigned)ldb,
+                                       (double)out[i*ldb+j], expected, (unsigned)i, (unsigned)j);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+/**
+ * The functors reach the same values through the dispatch, whatever the
+ * processor (or without any kernel at all).
+ */
+void check_functors()
+{
+    std::vector<float> a = random_floats(1002, false);
+    std::vector<float> b = random_floats(1002, false);
+    std::vector<float> ha = random_floats(1002, true);
+    std::vector<float> hb = random_floats(1002, true);
+    const size_t sizes[] = { 0, 1, 5, 17, 63, 1001 };
+    for (size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); ++s) {
+        size_t size = sizes[s];
+        const float* pa = &a[1];
+        const float* pb = &b[0];
+        TEST_CHECK(test::close(L2<float>()(pa, pb, size), SquaredL2Reference<Values<float> >()(pa, pb, size).value, 1e-5), "L2, size %u", (unsigned)size);
+        TEST_CHECK(test::close(L1<float>()(pa, pb, size), L1Reference<Values<float> >()(pa, pb, size).value, 1e-5), "L1, size %u", (unsigned)size);
+        TEST_CHECK(test::close(MaxDistance<float>()(pa, pb, size), MaxReference()(pa, pb, size).value, 1e-5), "Max, size %u", (unsigned)size);
+        TEST_CHECK(test::close(MinkowskiDistance<float>(3)(pa, pb, size), PowReference(3)(pa, pb, size).value, 1e-5), "Minkowski 3, size %u", (unsigned)size);
+        TEST_CHECK(test::close(MinkowskiDistance<float>(5)(pa, pb, size), PowReference(5)(pa, pb, size).value, 1e-5), "Minkowski 5, size %u", (unsigned)size);
+        TEST_CHECK(test::close(InnerProduct<float>()(pa, pb, size), InnerProductReference<Values<float> >()(pa, pb, size).value, 1e-5), "InnerProduct, size %u", (unsigned)size);
+        TEST_CHECK(test::close(Cosine<float>()(pa, pb, size), CosineReference()(pa, pb, size).value, 1e-5), "Cosine, size %u", (unsigned)size);
+
+        const float* ph = &ha[1];
+        const float* qh = &hb[0];
+        TEST_CHECK(test::close(HistIntersectionDistance<float>()(ph, qh, size), HistIntersectionReference()(ph, qh, size).value, 1e-5), "HistIntersection, size %u", (unsigned)size);
+        TEST_CHECK(test::close(ChiSquareDistance<float>()(ph, qh, size), ChiSquareReference()(ph, qh, size).value, 1e-5), "ChiSquare, size %u", (unsigned)size);
+        Reference kl = KLReference()(ph, qh, size);
+        TEST_CHECK(std::fabs(KL_Divergence<float>()(ph, qh, size)-kl.value)<=1e-5*(kl.magnitude>1 ? kl.magnitude : 1), "KL, size %u", (unsigned)size);
+    }
+}
+
+}
+
+int main()
+{
+    srand(1);
+#ifdef FLANN_SIMD_X86
+    check_float_kernels();
+    check_fixed_length_kernels();
+    check_byte_kernels();
+    check_half_kernels<simd::HalfFormat, float16>("L2<float16>", "L2<float16, float>", "InnerProduct<float16>", "InnerProduct<float16, float>");
+    check_half_kernels<simd::BFloat16Format, bfloat16>("L2<bfloat16>", "L2<bfloat16, float>", "InnerProduct<bfloat16>", "InnerProduct<bfloat16, float>");
+    check_l2_3d_block_kernels();
+    check_dot_block_kernels();
+#endif
+    check_functors();
+    return test::report("test_kernels");
+}
@@ -0,0 +1,446 @@
+/*
+ * Checks that exact searches (unlimited checks) of the hierarchical index find
+ * the neighbors of a brute force search, for every distance and every way of
+ * storing the points: packed leaves, pretransformed points, 16 bit floats
+ * searched with float queries, bytes, fixed dimensions, removed points, and
+ * the different center choosers, with points near and far from the origin and
+ * indices built by several threads. Also checks that approximate searches
+ * (eps>0) stay within their bound, and that the time budget reports the
+ * queries it cuts short.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "flann/flann.hpp"
+#include "test_common.h"
+
+using namespace flann;
+
+namespace
+{
+
+const size_t kPoints = 3000;
+const size_t kQueries = 40;
+const size_t kNeighbors = 7;
+
+template <typename T>
+std::vector<float> widen(const std::vector<T>& values)
+{
+    std::vector<float> result(values.size());
+    for (size_t i=0; i<values.size(); ++i) {
+        result[i] = (float)values[i];
+    }
+    return result;
+}
+
+template <typename T>
+bool close_distance(T a, T b)
+{
+    return test::close((double)a, (double)b, 1e-4);
+}
+
+/**
+ * Builds an index of dataset and checks its k nearest neighbor and radius
+ * searches of queries against a brute force search with the same distance.
+ * Removes the points of odd id below removed first.
+ */
+template <typename Distance, typename Query>
+void check_exact(const char* name, const Matrix<typename Distance::ElementType>& dataset,
+                 const Matrix<Query>& queries, const IndexParams& params,
+                 const Distance& distance = Distance(), size_t removed = 0)
+{
+    typedef typename Distance::ResultType DistanceType;
+
+    MultiThreadHierarchicalIndex<Distance> index(params, distance);
+    index.addPoints(dataset);
+    for (size_t id=1; id<removed; id+=2) {
+        index.removePoint(id);
+    }
+
+    std::vector<std::vector<size_t> > indices;
+    std::vector<std::vector<DistanceType> > dists;
+    SearchParams exact(FLANN_CHECKS_UNLIMITED);
+    index.knnSearch(queries, indices, dists, kNeighbors, exact);
+
+    std::vector<std::vector<size_t> > radius_indices;
+    std::vector<std::vector<DistanceType> > radius_dists;
+
+    for (size_t i=0; i<queries.rows; ++i) {
+        std::vector<DistanceType> expected;
+        std::vector<DistanceType> all(dataset.rows);
+        for (size_t j=0; j<dataset.rows; ++j) {
+            all[j] = distance(dataset[j], queries[i], dataset.cols);
+            if (j>=removed || j%2==0) expected.push_back(all[j]);
+        }
+        std::sort(expected.begin(), expected.end());
+
+        TEST_CHECK(indices[i].size()==kNeighbors, "%s, query %u: %u neighbors", name, (unsigned)i, (unsigned)indices[i].size());
+        for (size_t k=0; k<indices[i].size() && k<kNeighbors; ++k) {
+            size_t id = indices[i][k];
+            TEST_CHECK(close_distance(dists[i][k], expected[k]), "%s, query %u, neighbor %u: distance %g instead of %g",
+                       name, (unsigned)i, (unsigned)k, (double)dists[i][k], (double)expected[k]);
+            TEST_CHECK(id<dataset.rows && close_distance(all[id], dists[i][k]), "%s, query %u, neighbor %u: wrong point %u",
+                       name, (unsigned)i, (unsigned)k, (unsigned)id);
+            TEST_CHECK(id>=removed || id%2==0, "%s, query %u: removed point %u returned", name, (unsigned)i, (unsigned)id);
+        }
+
+        // the radius search finds the same neighbors with a radius between the
+        // k-th and the next distance (the queries with ties there are skipped)
+        if (!close_distance(expected[kNeighbors-1], expected[kNeighbors])) {
+            float radius = (float)((expected[kNeighbors-1]+expected[kNeighbors])/2);
+            Matrix<Query> query(queries[i], 1, queries.cols);
+            index.radiusSearch(query, radius_indices, radius_dists, radius, exact);
+            TEST_CHECK(radius_indices[0].size()==kNeighbors, "%s, query %u: radius search found %u neighbors instead of %u",
+                       name, (unsigned)i, (unsigned)radius_indices[0].size(), (unsigned)kNeighbors);
+            for (size_t k=0; k<radius_dists[0].size() && k<kNeighbors; ++k) {
+                TEST_CHECK(close_distance(radius_dists[0][k], expected[k]), "%s, query %u, radius neighbor %u: distance %g instead of %g",
+                           name, (unsigned)i, (unsigned)k, (double)radius_dists[0][k], (double)expected[k]);
+            }
+        }
+    }
+}
+
+MultiThreadHierarchicalIndexParams params(bool pack_leaves = false, bool pretransform = false,
+                                          flann_centers_init_t centers_init = FLANN_CENTERS_RANDOM)
+{
+    return MultiThreadHierarchicalIndexParams(8, centers_init, 3, 20, pack_leaves, pretransform);
+}
+
+void check_float_distances()
+{
+    const size_t cols = 24;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_exact("L2", dataset, queries, params(), L2<float>());
+    check_exact("L2, packed leaves", dataset, queries, params(true), L2<float>());
+    check_exact("L2, removed points", dataset, queries, params(), L2<float>(), kPoints/2);
+    check_exact("L2, packed leaves, removed points", dataset, queries, params(true), L2<float>(), kPoints/2);
+    check_exact("L2, k-means++", dataset, queries, params(false, false, FLANN_CENTERS_KMEANSPP), L2<float>());
+    check_exact("L2, Gonzales", dataset, queries, params(false, false, FLANN_CENTERS_GONZALES), L2<float>());
+    check_exact("L2, group-wise", dataset, queries, params(false, false, FLANN_CENTERS_GROUPWISE), L2<float>());
+    MultiThreadHierarchicalIndexParams sampled = params(false, false, FLANN_CENTERS_KMEANSPP);
+    sampled["centers_sample"] = 4;
+    check_exact("L2, sampled centers", dataset, queries, sampled, L2<float>());
+
+    check_exact("L2Fixed", dataset, queries, params(), L2Fixed<float, cols>());
+    check_exact("L2Fixed, packed leaves", dataset, queries, params(true), L2Fixed<float, cols>());
+    check_exact("L1", dataset, queries, params(), L1<float>());
+    check_exact("L1, packed leaves", dataset, queries, params(true), L1<float>());
+    check_exact("Max", dataset, queries, params(), MaxDistance<float>());
+    check_exact("Minkowski 3", dataset, queries, params(), MinkowskiDistance<float>(3));
+    check_exact("Minkowski 5", dataset, queries, params(), MinkowskiDistance<float>(5));
+    // not a metric, the search must not prune with bounds
+    check_exact("Minkowski -1", dataset, queries, params(), MinkowskiDistance<float>(-1));
+
+    check_exact("InnerProduct", dataset, queries, params(), InnerProduct<float>());
+    check_exact("InnerProduct, packed leaves", dataset, queries, params(true), InnerProduct<float>());
+    check_exact("Cosine", dataset, queries, params(), Cosine<float>());
+    check_exact("Cosine, pretransform", dataset, queries, params(false, true), Cosine<float>());
+    check_exact("Cosine, pretransform, packed leaves", dataset, queries, params(true, true), Cosine<float>());
+}
+
+/**
+ * Asks for more neighbors than the checks budget with half the points removed:
+ * the search must go on past the budget until the result is full.
+ */
+void check_full_results()
+{
+    const size_t points = 5000;
+    const size_t cols = 16;
+    const size_t knn = 200;
+    std::vector<float> values = test::random_points<float>(points, cols, false);
+    Matrix<float> dataset(&values[0], points, cols);
+    Matrix<float> queries(&values[0], kQueries, cols);
+
+    MultiThreadHierarchicalIndex<L2<float> > index(MultiThreadHierarchicalIndexParams(32, FLANN_CENTERS_RANDOM, 1, 20));
+    index.addPoints(dataset);
+    for (size_t id=1; id<points; id+=2) {
+        index.removePoint(id);
+    }
+
+    const int checks[] = { 1, 8 };
+    for (size_t c=0; c<sizeof(checks)/sizeof(checks[0]); ++c) {
+        std::vector<std::vector<size_t> > indices;
+        std::vector<std::vector<float> > dists;
+        index.knnSearch(queries, indices, dists, knn, SearchParams(checks[c]));
+        for (size_t i=0; i<kQueries; ++i) {
+            TEST_CHECK(indices[i].size()==knn, "%d checks, query %u: %u neighbors instead of %u",
+                       checks[c], (unsigned)i, (unsigned)indices[i].size(), (unsigned)knn);
+        }
+    }
+}
+
+/**
+ * Builds with several threads a dataset large enough for its clusters to be
+ * split by parallel tasks: the search stays exact, and the trees are the ones
+ * a single thread builds from the same seed (the approximate searches, which
+ * depend on the trees, return the same neighbors).
+ */
+void check_parallel_build()
+{
+    const size_t points = 5*CLUSTERING_TASK_MIN_POINTS;
+    const size_t cols = 8;
+    std::vector<float> values = test::random_points<float>(points, cols, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<float> dataset(&values[0], points, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    MultiThreadHierarchicalIndexParams serial(4, FLANN_CENTERS_KMEANSPP, 2, 20);
+    serial["cores"] = 1;
+    MultiThreadHierarchicalIndexParams parallel = serial;
+    parallel["cores"] = 4;
+    check_exact("L2, 4 build threads", dataset, queries, parallel, L2<float>());
+
+    const unsigned int seed = (unsigned int)rand();
+    MultiThreadHierarchicalIndex<L2<float> > serial_index(serial);
+    seed_random(seed);
+    serial_index.addPoints(dataset);
+    MultiThreadHierarchicalIndex<L2<float> > parallel_index(parallel);
+    seed_random(seed);
+    parallel_index.addPoints(dataset);
+
+    std::vector<std::vector<size_t> > serial_indices, parallel_indices;
+    std::vector<std::vector<float> > serial_dists, parallel_dists;
+    SearchParams approximate(16);
+    serial_index.knnSearch(queries, serial_indices, serial_dists, kNeighbors, approximate);
+    parallel_index.knnSearch(queries, parallel_indices, parallel_dists, kNeighbors, approximate);
+    for (size_t i=0; i<kQueries; ++i) {
+        TEST_CHECK(serial_indices[i]==parallel_indices[i] && serial_dists[i]==parallel_dists[i],
+                   "query %u: the trees built with 1 and 4 threads differ", (unsigned)i);
+    }
+}
+
+/**
+ * A time budget of 0 cuts every exact query short after its first branches,
+ * which still return a full result of neighbors that are in the dataset, and
+ * reports every query as truncated; without a budget none is.
+ */
+void check_time_budget()
+{
+    const size_t cols = 24;
+    const size_t knn = 5;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, false);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    // points of the dataset, found by the first descent
+    Matrix<float> queries(&points[0], kQueries, cols);
+    L2<float> distance;
+
+    MultiThreadHierarchicalIndex<L2<float> > index(params(), distance);
+    index.addPoints(dataset);
+
+    const int budgets[] = { 0, -1 };
+    for (size_t b=0; b<sizeof(budgets)/sizeof(budgets[0]); ++b) {
+        SearchParams search(FLANN_CHECKS_UNLIMITED);
+        search.max_time_us = budgets[b];
+        unsigned char expected_flag = budgets[b]<0 ? 0 : 1;
+        float radius = 3;
+
+        std::vector<std::vector<size_t> > indices;
+        std::vector<std::vector<float> > dists;
+        std::vector<unsigned char> truncated;
+        index.knnSearch(queries, indices, dists, knn, search, &truncated);
+        TEST_CHECK(truncated.size()==kQueries, "budget %d: %u knn flags", budgets[b], (unsigned)truncated.size());
+        for (size_t i=0; i<kQueries && i<truncated.size(); ++i) {
+            TEST_CHECK(truncated[i]==expected_flag, "budget %d, query %u: knn flag %d", budgets[b], (unsigned)i, truncated[i]);
+            TEST_CHECK(indices[i].size()==knn, "budget %d, query %u: %u neighbors instead of %u",
+                       budgets[b], (unsigned)i, (unsigned)indices[i].size(), (unsigned)knn);
+            for (size_t k=0; k<indices[i].size(); ++k) {
+                size_t id = indices[i][k];
+                TEST_CHECK(id<kPoints && close_distance(distance(dataset[id], queries[i], cols), dists[i][k]),
+                           "budget %d, query %u, neighbor %u: wrong point %u", budgets[b], (unsigned)i, (unsigned)k, (unsigned)id);
+            }
+        }
+
+        index.radiusSearch(queries, indices, dists, radius, search, &truncated);
+        TEST_CHECK(truncated.size()==kQueries, "budget %d: %u radius flags", budgets[b], (unsigned)truncated.size());
+        for (size_t i=0; i<kQueries && i<truncated.size(); ++i) {
+            size_t expected = 0;
+            for (size_t j=0; j<kPoints; ++j) {
+                if (distance(dataset[j], queries[i], cols)<=radius) ++expected;
+            }
+            TEST_CHECK(truncated[i]==expected_flag, "budget %d, query %u: radius flag %d", budgets[b], (unsigned)i, truncated[i]);
+            TEST_CHECK(!indices[i].empty() && indices[i].size()<=expected, "budget %d, query %u: %u radius neighbors of %u",
+                       budgets[b], (unsigned)i, (unsigned)indices[i].size(), (unsigned)expected);
+            TEST_CHECK(budgets[b]>=0 || indices[i].size()==expected, "budget %d, query %u: %u radius neighbors instead of %u",
+                       budgets[b], (unsigned)i, (unsigned)indices[i].size(), (unsigned)expected);
+            for (size_t k=0; k<dists[i].size(); ++k) {
+                TEST_CHECK(dists[i][k]<=radius, "budget %d, query %u: radius neighbor at %g", budgets[b], (unsigned)i, dists[i][k]);
+            }
+        }
+    }
+}
+
+/**
+ * Approximate searches without a checks limit: with eps>0 the k-th neighbor
+ * found is at most (1+eps) times farther than the true one, in the units of
+ * the metric (the square root of L2), and eps=0 stays exact.
+ */
+template <typename Distance>
+void check_eps(const char* name, const Matrix<float>& dataset, const Matrix<float>& queries,
+               const Distance& distance = Distance())
+{
+    typedef metric_distance<Distance> Metric;
+
+    MultiThreadHierarchicalIndex<Distance> index(params(), distance);
+    index.addPoints(dataset);
+
+    std::vector<float> expected(dataset.rows);
+    const float eps[] = { 0, 0.5f, 2 };
+    for (size_t e=0; e<sizeof(eps)/sizeof(eps[0]); ++e) {
+        std::vector<std::vector<size_t> > indices;
+        std::vector<std::vector<float> > dists;
+        index.knnSearch(queries, indices, dists, kNeighbors, SearchParams(FLANN_CHECKS_UNLIMITED, eps[e]));
+        for (size_t i=0; i<queries.rows; ++i) {
+            for (size_t j=0; j<dataset.rows; ++j) {
+                expected[j] = distance(dataset[j], queries[i], dataset.cols);
+            }
+            std::sort(expected.begin(), expected.end());
+            TEST_CHECK(indices[i].size()==kNeighbors, "%s, eps %g, query %u: %u neighbors",
+                       name, eps[e], (unsigned)i, (unsigned)indices[i].size());
+            for (size_t k=0; k<dists[i].size() && k<kNeighbors; ++k) {
+                if (eps[e]==0) {
+                    TEST_CHECK(close_distance(dists[i][k], expected[k]), "%s, eps 0, query %u, neighbor %u: distance %g instead of %g",
+                               name, (unsigned)i, (unsigned)k, (double)dists[i][k], (double)expected[k]);
+                    continue;
+                }
+                double found = Metric::to_metric(distance, dists[i][k]);
+                double bound = (1+eps[e])*Metric::to_metric(distance, expected[k]);
+                TEST_CHECK(found<=bound*(1+1e-5), "%s, eps %g, query %u, neighbor %u: distance %g beyond %g",
+                           name, eps[e], (unsigned)i, (unsigned)k, found, bound);
+            }
+        }
+    }
+}
+
+void check_approximate_distances()
+{
+    const size_t cols = 24;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_eps("L2", dataset, queries, L2<float>());
+    check_eps("L1", dataset, queries, L1<float>());
+}
+
+/**
+ * Points far from the origin: the labelling of the clusters expands |x-c|^2
+ * into |c|^2 - 2x.c, which cancels almost all the digits there and must not
+ * assign a point to a center that is not its closest one.
+ */
+void check_large_offsets()
+{
+    const size_t cols = 4;
+    const float offsets[] = { 5000, 20000 };
+    for (size_t o=0; o<sizeof(offsets)/sizeof(offsets[0]); ++o) {
+        std::vector<float> points(kPoints*cols);
+        std::vector<float> query_values(kQueries*cols);
+        for (size_t i=0; i<points.size(); ++i) points[i] = offsets[o]+(float)test::uniform();
+        for (size_t i=0; i<query_values.size(); ++i) query_values[i] = offsets[o]+(float)test::uniform();
+        Matrix<float> dataset(&points[0], kPoints, cols);
+        Matrix<float> queries(&query_values[0], kQueries, cols);
+
+        MultiThreadHierarchicalIndexParams wide(32, FLANN_CENTERS_RANDOM, 1, 10);
+        check_exact(o==0 ? "L2, offset 5000" : "L2, offset 20000", dataset, queries, wide, L2<float>());
+        check_exact(o==0 ? "L2Fixed, offset 5000" : "L2Fixed, offset 20000", dataset, queries, wide, L2Fixed<float, cols>());
+    }
+}
+
+void check_histogram_distances()
+{
+    const size_t cols = 20;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, true);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, true);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_exact("Hellinger", dataset, queries, params(), HellingerDistance<float>());
+    check_exact("Hellinger, pretransform", dataset, queries, params(false, true), HellingerDistance<float>());
+    check_exact("Hellinger, pretransform, packed leaves", dataset, queries, params(true, true), HellingerDistance<float>());
+    check_exact("ChiSquare", dataset, queries, params(), ChiSquareDistance<float>());
+    check_exact("KL", dataset, queries, params(), KL_Divergence<float>());
+    check_exact("HistIntersection", dataset, queries, params(), HistIntersectionDistance<float>());
+}
+
+void check_point_cloud()
+{
+    const size_t cols = 3;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, false, 10);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false, 10);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_exact("L2_3D", dataset, queries, params(), L2_3D<float>());
+    check_exact("L2_3D, packed leaves", dataset, queries, params(true), L2_3D<float>());
+    check_exact("L2_3D, packed leaves, removed points", dataset, queries, params(true), L2_3D<float>(), kPoints/2);
+}
+
+void check_byte_storage()
+{
+    const size_t cols = 33;
+    std::vector<unsigned char> points = test::random_points<unsigned char>(kPoints, cols, true, 255);
+    std::vector<unsigned char> query_values = test::random_points<unsigned char>(kQueries, cols, true, 255);
+    Matrix<unsigned char> dataset(&points[0], kPoints, cols);
+    Matrix<unsigned char> queries(&query_values[0], kQueries, cols);
+
+    check_exact("L2<unsigned char>", dataset, queries, params(), L2<unsigned char>());
+    check_exact("L2<unsigned char>, packed leaves", dataset, queries, params(true), L2<unsigned char>());
+    check_exact("L1<unsigned char>", dataset, queries, params(), L1<unsigned char>());
+}
+
+template <typename Half>
+void check_half_storage(const char* l2_name, const char* l2_packed_name, const char* ip_name)
+{
+    const size_t cols = 21;
+    std::vector<Half> points = test::random_points<Half>(kPoints, cols, false);
+    // the queries are not rounded to the storage format
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<Half> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_exact(l2_name, dataset, queries, params(), L2<Half>());
+    check_exact(l2_packed_name, dataset, queries, params(true), L2<Half>());
+    check_exact(ip_name, dataset, queries, params(), InnerProduct<Half>());
+
+    // and the same neighbors as the points widened to float
+    std::vector<float> wide = widen(points);
+    Matrix<float> wide_dataset(&wide[0], kPoints, cols);
+    MultiThreadHierarchicalIndex<L2<Half> > index(params());
+    index.addPoints(dataset);
+    std::vector<std::vector<size_t> > indices;
+    std::vector<std::vector<float> > dists;
+    index.knnSearch(queries, indices, dists, kNeighbors, SearchParams(FLANN_CHECKS_UNLIMITED));
+    for (size_t i=0; i<kQueries; ++i) {
+        for (size_t k=0; k<indices[i].size(); ++k) {
+            float expected = L2<float>()(wide_dataset[indices[i][k]], queries[i], cols);
+            TEST_CHECK(close_distance(dists[i][k], expected), "%s, query %u: distance %g, widened %g",
+                       l2_name, (unsigned)i, (double)dists[i][k], (double)expected);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    srand(1);
+    check_float_distances();
+    check_full_results();
+    check_approximate_distances();
+    check_time_budget();
+    check_large_offsets();
+    check_parallel_build();
+    check_histogram_distances();
+    check_point_cloud();
+    check_byte_storage();
+    check_half_storage<float16>("L2<float16>", "L2<float16>, packed leaves", "InnerProduct<float16>");
+    check_half_storage<bfloat16>("L2<bfloat16>", "L2<bfloat16>, packed leaves", "InnerProduct<bfloat16>");
+    return test::report("test_search");
+}
@@ -0,0 +1,185 @@
+/*
+ * Saves and loads hierarchical indices with each storage option (packed
+ * leaves, pretransformed points, 16 bit floats, L2_3D blocks, removed points)
+ * and checks that the loaded index returns the same neighbors as the saved
+ * one, with a limited number of checks (which depends on the covering radii
+ * and the pivot blocks) and with an exact search.
+ * Also checks that files of an older format are rejected.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "flann/flann.hpp"
+#include "test_common.h"
+
+using namespace flann;
+
+namespace
+{
+
+const char* kIndexFile = "test_serialization.idx";
+const size_t kPoints = 4000;
+const size_t kQueries = 30;
+const size_t kNeighbors = 5;
+
+template <typename Index, typename Query>
+void search(Index& index, const Matrix<Query>& queries, int checks,
+            std::vector<std::vector<size_t> >& indices, std::vector<std::vector<typename Index::DistanceType> >& dists)
+{
+    index.knnSearch(queries, indices, dists, kNeighbors, SearchParams(checks));
+}
+
+/**
+ * Builds an index of dataset (removing every third point when remove is set),
+ * saves it, loads it back and compares the searches of both.
+ */
+template <typename Distance, typename Query>
+void check_round_trip(const char* name, const Matrix<typename Distance::ElementType>& dataset,
+                      const Matrix<Query>& queries, MultiThreadHierarchicalIndexParams params,
+                      const Distance& distance = Distance(), bool remove = false)
+{
+    typedef MultiThreadIndex<Distance> Index;
+    typedef typename Distance::ResultType DistanceType;
+
+    params["save_dataset"] = true;
+    Index index(params, distance);
+    index.addPoints(dataset);
+    if (remove) {
+        for (size_t id=0; id<dataset.rows; id+=3) {
+            index.removePoint(id);
+        }
+    }
+    index.save(kIndexFile);
+    Index loaded(SavedIndexParams(kIndexFile), distance);
+
+    TEST_CHECK(loaded.size()==index.size(), "%s: %u points loaded instead of %u",
+               name, (unsigned)loaded.size(), (unsigned)index.size());
+    IndexParams loaded_params = loaded.getParameters();
+    TEST_CHECK(get_param<bool>(loaded_params, "pack_leaves")==get_param<bool>(params, "pack_leaves"),
+               "%s: pack_leaves not restored", name);
+    TEST_CHECK(get_param<bool>(loaded_params, "pretransform")==get_param<bool>(params, "pretransform"),
+               "%s: pretransform not restored", name);
+
+    const int checks[] = { 16, 128, FLANN_CHECKS_UNLIMITED };
+    for (size_t c=0; c<sizeof(checks)/sizeof(checks[0]); ++c) {
+        std::vector<std::vector<size_t> > indices, loaded_indices;
+        std::vector<std::vector<DistanceType> > dists, loaded_dists;
+        search(index, queries, checks[c], indices, dists);
+        search(loaded, queries, checks[c], loaded_indices, loaded_dists);
+        TEST_CHECK(indices==loaded_indices, "%s, %d checks: the loaded index finds other neighbors", name, checks[c]);
+        TEST_CHECK(dists==loaded_dists, "%s, %d checks: the loaded index finds other distances", name, checks[c]);
+        if (remove) {
+            for (size_t i=0; i<loaded_indices.size(); ++i) {
+                for (size_t k=0; k<loaded_indices[i].size(); ++k) {
+                    TEST_CHECK(loaded_indices[i][k]%3!=0, "%s: the loaded index returns removed point %u",
+                               name, (unsigned)loaded_indices[i][k]);
+                }
+            }
+        }
+    }
+}
+
+MultiThreadHierarchicalIndexParams params(bool pack_leaves = false, bool pretransform = false)
+{
+    return MultiThreadHierarchicalIndexParams(16, FLANN_CENTERS_KMEANSPP, 2, 20, pack_leaves, pretransform);
+}
+
+void check_float_indices()
+{
+    const size_t cols = 19;
+    std::vector<float> points = test::random_points<float>(kPoints, cols, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<float> dataset(&points[0], kPoints, cols);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+
+    check_round_trip("L2", dataset, queries, params(), L2<float>());
+    check_round_trip("L2, packed leaves", dataset, queries, params(true), L2<float>());
+    check_round_trip("L2, removed points", dataset, queries, params(), L2<float>(), true);
+    check_round_trip("L2, packed leaves, removed points", dataset, queries, params(true), L2<float>(), true);
+    check_round_trip("Minkowski 3", dataset, queries, params(), MinkowskiDistance<float>(3));
+    check_round_trip("Cosine, pretransform", dataset, queries, params(false, true), Cosine<float>());
+    check_round_trip("Cosine, pretransform, packed leaves", dataset, queries, params(true, true), Cosine<float>());
+
+    std::vector<float> histograms = test::random_points<float>(kPoints, cols, true);
+    std::vector<float> histogram_queries = test::random_points<float>(kQueries, cols, true);
+    Matrix<float> histogram_dataset(&histograms[0], kPoints, cols);
+    Matrix<float> histogram_query(&histogram_queries[0], kQueries, cols);
+    check_round_trip("Hellinger, pretransform", histogram_dataset, histogram_query, params(false, true), HellingerDistance<float>());
+}
+
+void check_point_cloud_index()
+{
+    std::vector<float> points = test::random_points<float>(kPoints, 3, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, 3, false);
+    Matrix<float> dataset(&points[0], kPoints, 3);
+    Matrix<float> queries(&query_values[0], kQueries, 3);
+    check_round_trip("L2_3D, packed leaves", dataset, queries, params(true), L2_3D<float>());
+}
+
+void check_other_storage()
+{
+    const size_t cols = 23;
+    std::vector<unsigned char> bytes = test::random_points<unsigned char>(kPoints, cols, true, 255);
+    std::vector<unsigned char> byte_queries = test::random_points<unsigned char>(kQueries, cols, true, 255);
+    check_round_trip("L2<unsigned char>, packed leaves", Matrix<unsigned char>(&bytes[0], kPoints, cols),
+                     Matrix<unsigned char>(&byte_queries[0], kQueries, cols), params(true), L2<unsigned char>());
+
+    std::vector<float16> halves = test::random_points<float16>(kPoints, cols, false);
+    std::vector<float> query_values = test::random_points<float>(kQueries, cols, false);
+    Matrix<float> queries(&query_values[0], kQueries, cols);
+    check_round_trip("L2<float16>, packed leaves", Matrix<float16>(&halves[0], kPoints, cols),
+                     queries, params(true), L2<float16>());
+    std::vector<bfloat16> bhalves = test::random_points<bfloat16>(kPoints, cols, false);
+    check_round_trip("InnerProduct<bfloat16>", Matrix<bfloat16>(&bhalves[0], kPoints, cols),
+                     queries, params(), InnerProduct<bfloat16>());
+}
+
+
+/**
+ * A file whose header says it was written by FLANN 1.8.4 must not load.
+ */
+void check_old_format_rejected()
+{
+    std::vector<float> points = test::random_points<float>(500, 4, false);
+    MultiThreadHierarchicalIndexParams index_params = params();
+    index_params["save_dataset"] = true;
+    MultiThreadIndex<L2<float> > index(index_params);
+    index.addPoints(Matrix<float>(&points[0], 500, 4));
+    index.save(kIndexFile);
+
+    FILE* file = fopen(kIndexFile, "r+b");
+    TEST_CHECK(file!=NULL, "cannot open %s", kIndexFile);
+    if (file==NULL) return;
+    IndexHeaderStruct header;
+    TEST_CHECK(fread(&header, sizeof(header), 1, file)==1, "cannot read the header");
+    memset(header.version, 0, sizeof(header.version));
+    strcpy(header.version, "1.8.4");
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+
+    bool rejected = false;
+    try {
+        MultiThreadIndex<L2<float> > loaded((SavedIndexParams(kIndexFile)));
+    }
+    catch (FLANNException&) {
+        rejected = true;
+    }
+    TEST_CHECK(rejected, "an index saved by FLANN 1.8.4 was loaded");
+}
+
+}
+
+int main()
+{
+    srand(1);
+    check_float_indices();
+    check_point_cloud_index();
+    check_other_storage();
+    check_old_format_rejected();
+    remove(kIndexFile);
+    return test::report("test_serialization");
+}